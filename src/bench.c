@@ -0,0 +1,347 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compute.h"
+#include "pds.h"
+
+// Kernel and engine microbenchmark. It runs in one process without MPI, on random pictures built in
+// memory, and prints one CSV row per configuration. Pixels are uniform in [64,255]: with small pixel
+// values allowed, a few |p-o|/p terms dominate the score and random windows match at any threshold,
+// while this range keeps window scores close to their mean, so only planted copies match.
+//
+// The kernel part times score_all_windows (the scoring kernels of compute.c, one thread, no prefilters)
+// over every window of an N x N picture for the plain, bounded and masked kernels. The limit of the
+// bounded kernels is a fraction of the median window score, which sets the early-exit rate; the rate and
+// the pixels actually compared are measured by replaying the row-wise abandonment outside the timed runs.
+//
+// The engine part times the searches of a libpds context (first, all, best and trie-first) on M objects
+// with the given thread count. The threshold is a fraction of the median window score, and a copy of the
+// first object can be planted at a fraction of the picture height, which sets how early the first-match
+// searches stop; the engine name carries that height ("first@0.1", "all@none"). Engine windows/pixels are
+// the nominal search space P*M*(N-n+1)^2 (times n^2), since the prefilters and early exits skip an unknown
+// part of it, and exit_rate is the fraction of pictures with a match (for kernels: of abandoned windows).
+//
+// Every configuration gets 'warmup' untimed runs, then 'reps' timed samples. One sample repeats the work
+// until it lasts at least --min-time seconds (calibrated during the warm-up), so short kernels are not
+// dominated by the timer. The CSV holds the mean time per run and the half-width of its 95% confidence
+// interval (Student t over the samples); the rates are derived from the mean. GB/s counts the 4-byte
+// picture and object ints read per compared pixel.
+//
+//   pds_bench [--reps R] [--warmup W] [--min-time s] [--threads T] [--seed S] [--quick] [--kernels-only] [--engines-only]
+
+static unsigned long long rng;
+
+static int next_pixel(void){
+ unsigned long long z=(rng+=0x9E3779B97F4A7C15ULL);
+ z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+ z=(z^(z>>27))*0x94D049BB133111EBULL;
+ return 64+(int)((z^(z>>31))%192);
+}
+
+static double now_s(void){
+ return omp_get_wtime();
+}
+
+// Two-sided 95% Student t quantiles for 1..30 degrees of freedom; 1.96 beyond
+static double t95(int df){
+ static const double t[30]={12.706,4.303,3.182,2.776,2.571,2.447,2.365,2.306,2.262,2.228,2.201,2.179,2.160,2.145,2.131,
+                            2.120,2.110,2.101,2.093,2.086,2.080,2.074,2.069,2.064,2.060,2.056,2.052,2.048,2.045,2.042};
+ return df<1?0.0:df<=30?t[df-1]:1.96;
+}
+
+typedef struct{
+    int reps;
+    int warmup;
+    double minTime;
+}
+BenchPlan;
+
+typedef struct{
+    double mean;     // seconds per run
+    double ci;       // half-width of the 95% interval of the mean
+}
+Timing;
+
+// Times fn(arg). The warm-up runs also find how many runs make one sample last at least plan->minTime.
+static Timing time_runs(const BenchPlan* plan,void (*fn)(void*),void* arg){
+ int inner=1;
+ for(int w=0;w<plan->warmup || w==0;++w){
+    const double t0=now_s();
+    for(int r=0;r<inner;++r)
+    fn(arg);
+    const double dt=now_s()-t0;
+    if(dt<plan->minTime)
+    inner=dt>0?(int)(inner*plan->minTime/dt)+1:inner*16;
+}
+ double sum=0.0, sum2=0.0;
+ for(int s=0;s<plan->reps;++s){
+    const double t0=now_s();
+    for(int r=0;r<inner;++r)
+    fn(arg);
+    const double t=(now_s()-t0)/inner;
+    sum+=t;
+    sum2+=t*t;
+}
+ Timing tm;
+ tm.mean=sum/plan->reps;
+ const double var=plan->reps>1?(sum2-sum*tm.mean)/(plan->reps-1):0.0;
+ tm.ci=t95(plan->reps-1)*sqrt(var>0?var:0.0)/sqrt((double)plan->reps);
+ return tm;
+}
+
+static void print_row(const char* part,const char* name,int N,int n,int M,double frac,double exitRate,const Timing* tm,double windows,double pixels){
+ printf("%s,%s,%d,%d,%d,%.3g,%.4f,%.6f,%.6f,%.0f,%.0f,%.4g,%.4g,%.4g\n",part,name,N,n,M,frac,exitRate,tm->mean*1e3,tm->ci*1e3,
+        windows,pixels,windows/tm->mean,pixels/tm->mean,pixels*8.0/tm->mean/1e9);
+ fflush(stdout);
+}
+
+static void random_picture(Picture* p,int id,int N){
+ p->id=id;
+ p->N=N;
+ p->a=(int*)malloc((size_t)N*N*sizeof(int));
+ p->roiRow=NULL;
+ p->roiSpan=NULL;
+ for(int t=0;t<N*N;++t)
+ p->a[t]=next_pixel();
+}
+
+// A random n x n object; with 'masked' every other pixel (by a fixed pattern) is masked, compacted like
+// the input reader does
+static void random_object(ObjectT* o,int id,int n,bool masked){
+ memset(o,0,sizeof *o);
+ o->id=id;
+ o->n=n;
+ o->a=(int*)malloc((size_t)n*n*sizeof(int));
+ for(int t=0;t<n*n;++t)
+ o->a[t]=next_pixel();
+ if(!masked)
+ return;
+ o->maskRow=(int*)malloc(((size_t)n+1)*sizeof(int));
+ o->maskCol=(int*)malloc(((size_t)n*n+1)*sizeof(int));
+ o->maskVal=(int*)malloc(((size_t)n*n+1)*sizeof(int));
+ int t=0;
+ for(int r=0;r<n;++r){
+    o->maskRow[r]=t;
+    for(int c=0;c<n;++c){
+        if((r*7+c*3)%2){
+            o->a[r*n+c]=0;
+            continue;
+        }
+        o->maskCol[t]=c;
+        o->maskVal[t]=o->a[r*n+c];
+        t++;
+    }
+}
+ o->maskRow[n]=t;
+}
+
+static void free_object(ObjectT* o){
+ free(o->a);
+ free(o->maskRow);
+ free(o->maskCol);
+ free(o->maskVal);
+}
+
+static int cmp_double(const void* x,const void* y){
+ const double a=*(const double*)x, b=*(const double*)y;
+ return (a>b)-(a<b);
+}
+
+// Median full score over all windows of the picture
+static double median_score(const Picture* P,const ObjectT* O){
+ const int W=P->N-O->n+1;
+ double* s=(double*)malloc((size_t)W*W*sizeof(double));
+ score_all_windows(P,O,INFINITY,s);
+ qsort(s,(size_t)W*W,sizeof(double),cmp_double);
+ const double m=s[(size_t)W*W/2];
+ free(s);
+ return m;
+}
+
+// Pixels a bounded kernel compares over all windows: the row-wise abandonment replayed in plain code
+static double replay_pixels(const Picture* P,const ObjectT* O,double limit){
+ const int N=P->N, n=O->n, W=N-n+1;
+ double pixels=0.0;
+ for(int i=0;i<W;++i)
+ for(int j=0;j<W;++j){
+    double sum=0.0;
+    for(int r=0;r<n;++r){
+        const int* prow=P->a+(size_t)(i+r)*N+j;
+        if(O->maskRow){
+            for(int t=O->maskRow[r];t<O->maskRow[r+1];++t)
+            sum+=fabs((double)(prow[O->maskCol[t]]-O->maskVal[t])/(double)prow[O->maskCol[t]]);
+            pixels+=O->maskRow[r+1]-O->maskRow[r];
+        }
+        else {
+            for(int c=0;c<n;++c)
+            sum+=fabs((double)(prow[c]-O->a[r*n+c])/(double)prow[c]);
+            pixels+=n;
+        }
+        if(sum>limit)
+        break;
+    }
+}
+ return pixels;
+}
+
+typedef struct{
+    const Picture* P;
+    const ObjectT* O;
+    double limit;
+    long long sink;
+}
+KernelRun;
+
+static void kernel_run(void* arg){
+ KernelRun* k=(KernelRun*)arg;
+ k->sink+=score_all_windows(k->P,k->O,k->limit,NULL);
+}
+
+static void bench_kernels(const BenchPlan* plan,bool quick){
+ static const int Ns[]={64,256,1024};
+ static const int ns[]={4,8,16,32};
+ static const double fracs[]={0.25,0.5,0.9,1.0,INFINITY};
+ const int nN=quick?2:3, nn=quick?3:4;
+ for(int a=0;a<nN;++a)
+ for(int b=0;b<nn;++b){
+    const int N=Ns[a], n=ns[b], W=N-n+1;
+    if(n>N)
+    continue;
+    Picture P;
+    random_picture(&P,1,N);
+    for(int kind=0;kind<3;++kind){
+        static const char* names[]={"plain","bounded","masked"};
+        ObjectT O;
+        random_object(&O,1,n,kind==2);
+        const double median=median_score(&P,&O);
+        for(int f=0;f<5;++f){
+            // The plain kernel has no limit; the bounded ones sweep it
+            if(kind==0 && f<4)
+            continue;
+            KernelRun k={&P,&O,fracs[f]*median,0};
+            const Timing tm=time_runs(plan,kernel_run,&k);
+            const double exitRate=(double)score_all_windows(&P,&O,k.limit,NULL)/((double)W*W);
+            const double pixels=isinf(k.limit)?(double)W*W*(O.maskRow?O.maskRow[n]:n*n):replay_pixels(&P,&O,k.limit);
+            print_row("kernel",names[kind],N,n,1,fracs[f],exitRate,&tm,(double)W*W,pixels);
+        }
+        free_object(&O);
+    }
+    free(P.a);
+}
+}
+
+typedef struct{
+    PdsContext* ctx;
+    const Picture* pics;
+    int P;
+    double threshold;
+    bool all;
+    long long sink;      // pictures with a match, over all runs
+}
+EngineRun;
+
+static void engine_run(void* arg){
+ EngineRun* e=(EngineRun*)arg;
+ for(int p=0;p<e->P;++p){
+    if(e->all){
+        MatchList l={0};
+        e->sink+=pds_search_all(e->ctx,&e->pics[p],e->threshold,&l)>0;
+        match_list_free(&l);
+    }
+    else {
+        MatchResult r;
+        e->sink+=pds_search(e->ctx,&e->pics[p],e->threshold,&r);
+    }
+}
+}
+
+static void bench_engines(const BenchPlan* plan,int threads,bool quick){
+ static const int Ns[]={128,256,512};
+ static const int ns[]={8,16};
+ static const double fracs[]={0.01,0.5};
+ static const double plants[]={0.1,0.5,-1.0};
+ static const char* plantNames[]={"0.1","0.5","none"};
+ static const char* names[]={"first","all","best","trie"};
+ const int M=8, Pn=quick?2:4, nN=quick?1:3;
+ for(int a=0;a<nN;++a)
+ for(int b=0;b<2;++b){
+    const int N=Ns[a], n=ns[b], W=N-n+1;
+    ObjectT objs[8];
+    for(int k=0;k<M;++k)
+    random_object(&objs[k],k+1,n,false);
+    // Every plant configuration starts from the same random pictures
+    const unsigned long long picSeed=rng;
+    for(int pl=0;pl<3;++pl){
+        Picture pics[4];
+        rng=picSeed;
+        for(int p=0;p<Pn;++p)
+        random_picture(&pics[p],p+1,N);
+        const double median=median_score(&pics[0],&objs[0]);
+        // Plant an exact copy of the first object in column 0 at the given height in every picture
+        if(plants[pl]>=0)
+        for(int p=0;p<Pn;++p){
+            const int r0=(int)(plants[pl]*(W-1));
+            for(int r=0;r<n;++r)
+            memcpy(pics[p].a+(size_t)(r0+r)*N,objs[0].a+(size_t)r*n,(size_t)n*sizeof(int));
+        }
+        for(int f=0;f<2;++f)
+        for(int e=0;e<4;++e){
+            PdsOptions o;
+            pds_default_options(&o);
+            o.mode=e==1?SEARCH_ALL:e==2?SEARCH_BEST:SEARCH_FIRST;
+            o.trie=e==3;
+            o.threads=threads;
+            EngineRun run={pds_create(objs,M,&o),pics,Pn,fracs[f]*median,e==1,0};
+            if(!run.ctx){
+                fprintf(stderr,"pds_create failed\n");
+                exit(1);
+            }
+            // One untimed run counts the pictures with a match
+            engine_run(&run);
+            const double found=(double)run.sink/Pn;
+            const Timing tm=time_runs(plan,engine_run,&run);
+            const double windows=(double)Pn*M*W*W;
+            char name[32];
+            snprintf(name,sizeof name,"%s@%s",names[e],plantNames[pl]);
+            print_row("engine",name,N,n,M,fracs[f],found,&tm,windows,windows*n*n);
+            pds_destroy(run.ctx);
+        }
+        for(int p=0;p<Pn;++p)
+        free(pics[p].a);
+    }
+    for(int k=0;k<M;++k)
+    free_object(&objs[k]);
+}
+}
+
+int main(int argc,char** argv){
+ BenchPlan plan={10,2,0.01};
+ int threads=0;
+ bool quick=false, kernels=true, engines=true;
+ for(int a=1;a<argc;++a){
+    if(strcmp(argv[a],"--reps")==0 && a+1<argc) plan.reps=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--warmup")==0 && a+1<argc) plan.warmup=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--min-time")==0 && a+1<argc) plan.minTime=atof(argv[++a]);
+    else if(strcmp(argv[a],"--threads")==0 && a+1<argc) threads=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--seed")==0 && a+1<argc) rng=strtoull(argv[++a],NULL,10);
+    else if(strcmp(argv[a],"--quick")==0) quick=true;
+    else if(strcmp(argv[a],"--kernels-only")==0) engines=false;
+    else if(strcmp(argv[a],"--engines-only")==0) kernels=false;
+    else {
+        fprintf(stderr,"Usage: %s [--reps R] [--warmup W] [--min-time s] [--threads T] [--seed S] [--quick] [--kernels-only] [--engines-only]\n",argv[0]);
+        return 1;
+    }
+}
+ if(plan.reps<1||plan.warmup<0||plan.minTime<0||threads<0){
+    fprintf(stderr,"reps must be positive, warmup, min-time and threads non-negative\n");
+    return 1;
+}
+ printf("part,name,N,n,M,limit_frac,exit_rate,ms_mean,ms_ci95,windows,pixels,windows_per_s,pixels_per_s,gb_per_s\n");
+ if(kernels)
+ bench_kernels(&plan,quick);
+ if(engines)
+ bench_engines(&plan,threads,quick);
+ return 0;
+}
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Result cache on disk. Every entry is one small file in the cache directory named after the 128-bit key
+// (32 hex digits) and holding one MatchResult. Entries are written to a temporary file and renamed, so
+// concurrent runs sharing a directory never see half-written entries. A hit sets the entry's mtime to now,
+// which makes the mtime the LRU order; cache_close deletes the least recently used entries until the disk
+// usage of the directory is below the limit. The "stats" file accumulates the hit/miss counters over runs.
+
+// 64-bit hash of n ints (multiply-xorshift per element, murmur-style finalizer). It is not cryptographic;
+// the cache uses two of them with different seeds as its 128-bit key.
+unsigned long long hash_ints(const int* a,size_t n,unsigned long long seed){
+ unsigned long long h=seed^(n*0x9E3779B97F4A7C15ULL);
+ for(size_t t=0;t<n;++t){
+    h^=(unsigned int)a[t];
+    h*=0xff51afd7ed558ccdULL;
+    h^=h>>32;
+}
+ h^=h>>33;
+ h*=0xc4ceb9fe1a85ec53ULL;
+ h^=h>>33;
+ return h;
+}
+
+static unsigned long long hash_mix(unsigned long long h,unsigned long long v){
+ int w[2]={(int)(v&0xffffffffu),(int)(v>>32)};
+ return hash_ints(w,2,h);
+}
+
+// Hash of the whole object library: ids, sizes, pixels and masks of all objects in order.
+unsigned long long cache_library_hash(const ObjectT* objs,int M){
+ unsigned long long h=hash_mix(0x6c62272e07bb0142ULL,(unsigned long long)M);
+ for(int k=0;k<M;++k){
+    const ObjectT* O=&objs[k];
+    h=hash_mix(h,((unsigned long long)(unsigned)O->id<<32)|(unsigned)O->n);
+    h=hash_ints(O->a,(size_t)O->n*O->n,h);
+    if(O->maskRow){
+        h=hash_ints(O->maskRow,(size_t)O->n+1,h);
+        h=hash_ints(O->maskCol,(size_t)O->maskRow[O->n],h);
+    }
+}
+ return h;
+}
+
+// Builds the key of one picture; 'tag' describes everything else that changes the result (mode and options).
+CacheKey cache_key(const Picture* pic,unsigned long long libHash,double threshold,const char* tag){
+ CacheKey k;
+ const unsigned long long seeds[2]={0x243f6a8885a308d3ULL,0x13198a2e03707344ULL};
+ unsigned long long tb;
+ memcpy(&tb,&threshold,sizeof tb);
+ for(int s=0;s<2;++s){
+    unsigned long long h=hash_mix(seeds[s],(unsigned long long)pic->N);
+    h=hash_ints(pic->a,(size_t)pic->N*pic->N,h);
+    if(pic->roiRow){
+        h=hash_ints(pic->roiRow,(size_t)pic->N+1,h);
+        h=hash_ints(pic->roiSpan,(size_t)pic->roiRow[pic->N]*2,h);
+    }
+    h=hash_mix(h,libHash);
+    h=hash_mix(h,tb);
+    for(const char* c=tag;*c;++c)
+    h=hash_mix(h,(unsigned char)*c);
+    k.h[s]=h;
+}
+ return k;
+}
+
+static void entry_path(const ResultCache* c,CacheKey key,char* path,size_t cap){
+ snprintf(path,cap,"%s/%016llx%016llx",c->dir,key.h[0],key.h[1]);
+}
+
+// Opens (creating if needed) the cache directory. limitBytes is the disk usage the directory is trimmed
+// to when the cache is closed.
+bool cache_open(ResultCache* c,const char* dir,long long limitBytes){
+ memset(c,0,sizeof *c);
+ if(strlen(dir)+40>=sizeof c->dir)
+ return false;
+ strcpy(c->dir,dir);
+ c->limit=limitBytes;
+ if(mkdir(dir,0755)!=0 && errno!=EEXIST){
+    fprintf(stderr,"Failed to create cache directory: %s\n",dir);
+    return false;
+}
+ return true;
+}
+
+// Looks a key up; on a hit fills 'out' (except pictureId, which the caller owns) and refreshes the LRU time.
+bool cache_lookup(ResultCache* c,CacheKey key,MatchResult* out){
+ char path[1100];
+ entry_path(c,key,path,sizeof path);
+ FILE* f=fopen(path,"r");
+ int found,objectId,posI,posJ,orientation;
+ double score;
+ bool ok=f && fscanf(f,"pds-result 1 %d %d %d %d %lf %d",&found,&objectId,&posI,&posJ,&score,&orientation)==6;
+ if(f)
+ fclose(f);
+ if(!ok){
+    c->misses++;
+    return false;
+}
+ out->found=found;
+ out->objectId=objectId;
+ out->posI=posI;
+ out->posJ=posJ;
+ out->score=score;
+ out->orientation=orientation;
+ utimensat(AT_FDCWD,path,NULL,0);
+ c->hits++;
+ return true;
+}
+
+bool cache_store(ResultCache* c,CacheKey key,const MatchResult* r){
+ char path[1100], tmp[1200];
+ entry_path(c,key,path,sizeof path);
+ snprintf(tmp,sizeof tmp,"%s.tmp%ld",path,(long)getpid());
+ FILE* f=fopen(tmp,"w");
+ if(!f)
+ return false;
+ fprintf(f,"pds-result 1 %d %d %d %d %.17g %d\n",r->found,r->objectId,r->posI,r->posJ,r->score,r->orientation);
+ if(fclose(f)!=0 || rename(tmp,path)!=0){
+    unlink(tmp);
+    return false;
+}
+ c->stores++;
+ return true;
+}
+
+typedef struct{
+    char name[40];
+    long long bytes;
+    long long mtime;
+}
+CacheEntry;
+
+static int cmp_entry_age(const void* x,const void* y){
+ const CacheEntry* a=(const CacheEntry*)x;
+ const CacheEntry* b=(const CacheEntry*)y;
+ return (a->mtime>b->mtime)-(a->mtime<b->mtime);
+}
+
+// Deletes least recently used entries until the directory's disk usage is within the limit.
+static void cache_evict(ResultCache* c){
+ DIR* d=opendir(c->dir);
+ if(!d)
+ return;
+ CacheEntry* e=NULL;
+ int n=0, cap=0;
+ long long total=0;
+ struct dirent* de;
+ char path[1100];
+ while((de=readdir(d))){
+    if(strlen(de->d_name)!=32)
+    continue;
+    struct stat st;
+    snprintf(path,sizeof path,"%s/%s",c->dir,de->d_name);
+    if(stat(path,&st)!=0)
+    continue;
+    if(n==cap){
+        cap=cap?2*cap:256;
+        CacheEntry* g=(CacheEntry*)realloc(e,(size_t)cap*sizeof(CacheEntry));
+        if(!g)
+        break;
+        e=g;
+    }
+    strcpy(e[n].name,de->d_name);
+    e[n].bytes=(long long)st.st_blocks*512;
+    e[n].mtime=(long long)st.st_mtim.tv_sec*1000000000LL+st.st_mtim.tv_nsec;
+    total+=e[n].bytes;
+    n++;
+}
+ closedir(d);
+ if(total>c->limit){
+    qsort(e,(size_t)n,sizeof(CacheEntry),cmp_entry_age);
+    for(int t=0;t<n && total>c->limit;++t){
+        snprintf(path,sizeof path,"%s/%s",c->dir,e[t].name);
+        if(unlink(path)==0){
+            total-=e[t].bytes;
+            c->evictions++;
+        }
+    }
+}
+ free(e);
+}
+
+// Trims the cache to its size limit and adds this run's counters to the directory's "stats" file.
+void cache_close(ResultCache* c){
+ cache_evict(c);
+ char path[1100];
+ snprintf(path,sizeof path,"%s/stats",c->dir);
+ long long h=0, m=0, s=0, e=0;
+ FILE* f=fopen(path,"r");
+ if(f){
+    if(fscanf(f,"hits %lld misses %lld stores %lld evictions %lld",&h,&m,&s,&e)!=4)
+    h=m=s=e=0;
+    fclose(f);
+}
+ f=fopen(path,"w");
+ if(f){
+    fprintf(f,"hits %lld misses %lld stores %lld evictions %lld\n",h+c->hits,m+c->misses,s+c->stores,e+c->evictions);
+    fclose(f);
+}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+// Persistent content-addressed result cache (see cache.c). The key of a picture covers its size, pixels
+// and ROI, the hash of the object library, the threshold and a tag describing the search options.
+typedef struct{
+    unsigned long long h[2];
+}
+CacheKey;
+
+typedef struct{
+    char dir[1024];
+    long long limit;
+    long long hits;
+    long long misses;
+    long long stores;
+    long long evictions;
+}
+ResultCache;
+
+unsigned long long hash_ints(const int* a,size_t n,unsigned long long seed);
+unsigned long long cache_library_hash(const ObjectT* objs,int M);
+CacheKey cache_key(const Picture* pic,unsigned long long libHash,double threshold,const char* tag);
+bool cache_open(ResultCache* c,const char* dir,long long limitBytes);
+bool cache_lookup(ResultCache* c,CacheKey key,MatchResult* out);
+bool cache_store(ResultCache* c,CacheKey key,const MatchResult* r);
+void cache_close(ResultCache* c);
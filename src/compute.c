@@ -1,13 +1,180 @@
 #include "compute.h"
+#include "trace.h"
 #include <math.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
 #include <omp.h>
 
+// Hot-path counters (build with -DPDS_COUNTERS, "make COUNTERS=1"). Every OpenMP thread adds to its own
+// cache-line sized slot with plain stores; HOT_COLLECT runs on the calling thread after a parallel region,
+// when the workers are idle, and moves the slots into the counters of an object and of the current
+// picture. There is one slot per thread of omp_get_max_threads(), (re)allocated by hot_collect; a thread
+// without a slot (before the first collect, or after the thread count grew) adds atomically to g_hotSpill
+// instead, so no two threads ever share a slot. Without the flag the macros expand to nothing, so the
+// engines carry no cost at all.
+#ifdef PDS_COUNTERS
+typedef struct{
+    _Alignas(64) HotCounters c;
+} 
+HotSlot;
+static HotSlot* g_hot=NULL;
+static int g_hotThreads=0;
+static HotCounters g_hotSpill;
+static HotCounters g_hotTotal;
+static HotCounters g_hotCur;
+static HotCounters* g_hotObj=NULL;
+static int g_hotObjCount=0;
+static HotPicture* g_hotPic=NULL;
+static int g_hotPicCount=0, g_hotPicCap=0;
+#define HOT_ADD(field,v) do{ \
+    const int hotT_=omp_get_thread_num(); \
+    if(hotT_<g_hotThreads) g_hot[hotT_].c.field+=(v); \
+    else __atomic_fetch_add(&g_hotSpill.field,(long long)(v),__ATOMIC_RELAXED); \
+}while(0)
+#define HOT_ONLY(x) x
+#define HOT_COLLECT(k) hot_collect(k)
+#define HOT_PICTURE(id) hot_picture(id)
+
+static void hot_add_to(HotCounters* d,const HotCounters* s){
+ long long* a=(long long*)d;
+ const long long* b=(const long long*)s;
+ for(int f=0;f<HOT_FIELDS;++f) 
+ a[f]+=b[f];
+}
+
+// Moves the thread slots into the total and, for k >= 0, into the current picture and object k; k < 0 only 
+// drains work that belongs to no picture (other engines, or before the picture started). Grows the slots 
+// when omp_get_max_threads() has grown; this runs outside parallel regions, so no thread is adding.
+static void hot_collect(int k){
+ HotCounters sum=g_hotSpill;
+ memset(&g_hotSpill,0,sizeof g_hotSpill);
+ for(int t=0;t<g_hotThreads;++t){
+    hot_add_to(&sum,&g_hot[t].c);
+    memset(&g_hot[t].c,0,sizeof(HotCounters));
+}
+ const int want=omp_get_max_threads();
+ if(want>g_hotThreads){
+    HotSlot* s=(HotSlot*)aligned_alloc(_Alignof(HotSlot),(size_t)want*sizeof(HotSlot));
+    if(s){
+        memset(s,0,(size_t)want*sizeof(HotSlot));
+        free(g_hot);
+        g_hot=s;
+        g_hotThreads=want;
+    }
+}
+ hot_add_to(&g_hotTotal,&sum);
+ if(k<0) 
+ return;
+ hot_add_to(&g_hotCur,&sum);
+ if(k>=g_hotObjCount){
+    HotCounters* o=(HotCounters*)realloc(g_hotObj,((size_t)k+1)*sizeof(HotCounters));
+    if(!o) 
+    return;
+    memset(o+g_hotObjCount,0,((size_t)k+1-g_hotObjCount)*sizeof(HotCounters));
+    g_hotObj=o;
+    g_hotObjCount=k+1;
+}
+ hot_add_to(&g_hotObj[k],&sum);
+}
+
+// Closes the current picture: its counters become one HotPicture record.
+static void hot_picture(int id){
+ if(g_hotPicCount==g_hotPicCap){
+    const int cap=g_hotPicCap?2*g_hotPicCap:64;
+    HotPicture* p=(HotPicture*)realloc(g_hotPic,(size_t)cap*sizeof(HotPicture));
+    if(!p) 
+    return;
+    g_hotPic=p;
+    g_hotPicCap=cap;
+}
+ g_hotPic[g_hotPicCount].pictureId=id;
+ g_hotPic[g_hotPicCount++].c=g_hotCur;
+ memset(&g_hotCur,0,sizeof g_hotCur);
+}
+
+// This function returns the counters of this process: the total (including the work of engines that
+// don't attribute it to objects and pictures), one record per object index and one per picture searched
+// by find_match_for_picture. The arrays stay owned by compute.c.
+void hot_counters(HotCounters* total,const HotCounters** objects,int* objectCount,const HotPicture** pictures,int* pictureCount){
+ hot_collect(-1);
+ memset(&g_hotCur,0,sizeof g_hotCur);
+ *total=g_hotTotal;
+ *objects=g_hotObj;
+ *objectCount=g_hotObjCount;
+ *pictures=g_hotPic;
+ *pictureCount=g_hotPicCount;
+}
+#else
+#define HOT_ADD(field,v) ((void)0)
+#define HOT_ONLY(x)
+#define HOT_COLLECT(k) ((void)0)
+#define HOT_PICTURE(id) ((void)0)
+#endif
+
+// Score of a masked object: only the active pixels are compared. The active pixels are kept compacted per 
+// object row (maskRow offsets into the maskCol/maskVal lists), so the cost is proportional to the number 
+// of active pixels, not n*n. Within a row the picture pixels are gathered by column index; the loop is 
+// marked for SIMD so that it turns into vector gathers when the target supports them. Stops after a row 
+// once the partial sum exceeds 'limit' (pass INFINITY for the full score).
+static inline double match_position_masked(const Picture* P,const ObjectT* O,int i,int j,double limit){
+ const int N=P->N, n=O->n; 
+ const int* rowPtr=O->maskRow; 
+ const int* col=O->maskCol; 
+ const int* val=O->maskVal; 
+ double sum=0.0;
+ for(int r=0;r<n;++r){
+    const int* prow=P->a+(size_t)(i+r)*N+j;
+    double rs=0.0;
+    #pragma omp simd reduction(+:rs)
+    for(int t=rowPtr[r];t<rowPtr[r+1];++t){
+        int pv=prow[col[t]]; 
+        rs+=fabs((double)(pv-val[t])/(double)pv);
+    }
+    sum+=rs;
+    if(sum>limit){
+        HOT_ADD(windows,1);
+        HOT_ADD(pixels,rowPtr[r+1]);
+        HOT_ADD(abandoned,1);
+        return sum;
+    }
+}
+ HOT_ADD(windows,1);
+ HOT_ADD(pixels,rowPtr[n]);
+ return sum;
+}
+
 // This function calculates how well a small object matches a specific position in a larger picture. 
 // It compares each pixel in the object with the corresponding pixel in the picture at position (i,j). 
 // For each pixel pair, it calculates the relative difference: |picture_value - object_value| / picture_value. 
 // It adds up all these differences and returns the total sum. A smaller sum means a better match. 
 // If the sum is below the threshold, we consider it a successful match.
 static inline double match_position(const Picture* P,const ObjectT* O,int i,int j){
+ if(O->maskRow) 
+ return match_position_masked(P,O,i,j,INFINITY);
+ const int N=P->N, n=O->n; 
+ const int* p=P->a; 
+ const int* o=O->a; 
+ double sum=0.0;
+ for(int r=0;r<n;++r){
+    int baseP=(i+r)*N+j, baseO=r*n; 
+    for(int c=0;c<n;++c){
+        int pv=p[baseP+c], ov=o[baseO+c]; 
+        sum+=fabs((double)(pv-ov)/(double)pv);
+    }
+}
+ HOT_ADD(windows,1);
+ HOT_ADD(pixels,(long long)n*n);
+ return sum;
+}
+
+// Same score as match_position, but gives up as soon as the partial sum exceeds 'limit'. All terms are 
+// non-negative, so a partial sum is already a lower bound of the full score and the window can be 
+// abandoned. The check is done once per object row to keep the inner loop simple. The returned value is 
+// the exact score if it is <= limit, otherwise some value > limit.
+static inline double match_position_bounded(const Picture* P,const ObjectT* O,int i,int j,double limit){
+ if(O->maskRow) 
+ return match_position_masked(P,O,i,j,limit);
  const int N=P->N, n=O->n; 
  const int* p=P->a; 
  const int* o=O->a; 
@@ -18,10 +185,471 @@ static inline double match_position(const Picture* P,const ObjectT* O,int i,int
         int pv=p[baseP+c], ov=o[baseO+c]; 
         sum+=fabs((double)(pv-ov)/(double)pv);
     }
+    if(sum>limit){
+        HOT_ADD(windows,1);
+        HOT_ADD(pixels,(long long)(r+1)*n);
+        HOT_ADD(abandoned,1);
+        return sum;
+    }
 }
+ HOT_ADD(windows,1);
+ HOT_ADD(pixels,(long long)n*n);
  return sum;
 }
 
+// Scores every window of a picture against one object with the same inlined kernels the engines use: 
+// match_position for limit INFINITY, otherwise match_position_bounded (masked objects take the masked 
+// kernel either way). Single-threaded and without prefilters, so the kernels can be timed in isolation 
+// (see bench.c). Scores go to 'scores' in row-major window order when it is not NULL. Returns the number 
+// of windows whose score exceeds the limit, i.e. the windows a bounded kernel abandoned.
+long long score_all_windows(const Picture* P,const ObjectT* O,double limit,double* scores){
+ const int W=P->N-O->n+1;
+ long long over=0;
+ for(int i=0;i<W;++i)
+ for(int j=0;j<W;++j){
+    const double s=isinf(limit)?match_position(P,O,i,j):match_position_bounded(P,O,i,j,limit);
+    if(scores) 
+    scores[(size_t)i*W+j]=s;
+    over+=s>limit;
+}
+ return over;
+}
+
+// Region-of-interest helpers. A picture may carry an ROI: for every candidate row i a sorted list of 
+// disjoint column spans [j0,j1] of allowed top-left positions (CSR layout in roiRow/roiSpan). All engines 
+// walk rows and spans through these helpers, so a picture without an ROI behaves as one span [0,maxJ] 
+// per row and rows outside the ROI never become tasks. Span ends are clipped to maxJ by the caller.
+static inline bool roi_row_active(const Picture* P,int i){
+ return !P->roiRow || P->roiRow[i+1]>P->roiRow[i];
+}
+
+static inline int roi_row_spans(const Picture* P,int i,int maxJ,int* full,const int** spans){
+ if(!P->roiRow){
+    full[0]=0;
+    full[1]=maxJ;
+    *spans=full;
+    return 1;
+}
+ *spans=P->roiSpan+2*P->roiRow[i];
+ return P->roiRow[i+1]-P->roiRow[i];
+}
+
+// Summed-area table over a rectangle of a picture, used for the window-sum lower bound. s[r*W+c] is the 
+// sum of the table's rows above r and columns left of c (both relative to r0,c0), so the sum of any window 
+// is four lookups. minv/maxv are the smallest and largest pixel inside the rectangle.
+typedef struct{
+    long long* s;
+    int r0;
+    int c0;
+    int W;
+    int minv;
+    int maxv;
+} 
+SatTable;
+
+// This helper builds the summed-area table for the part of the picture that the search can touch. Without 
+// an ROI that is the whole picture. With an ROI it is the bounding box of the allowed top-left positions 
+// grown by the largest object size 'maxN', so building the table (and the min/max used by the bound) costs 
+// ROI area instead of picture area, and the bound gets tighter as well. Returns false if memory runs out 
+// or the ROI is empty.
+static bool build_sat(const Picture* P,int maxN,SatTable* t){
+ const int N=P->N;
+ int r0=0, r1=N, c0=0, c1=N;
+ if(P->roiRow){
+    r0=N; r1=0; c0=N; c1=0;
+    for(int i=0;i<N;++i){
+        if(P->roiRow[i+1]==P->roiRow[i]) 
+        continue;
+        if(i<r0) r0=i;
+        r1=i+maxN;
+        const int* sp=P->roiSpan+2*P->roiRow[i];
+        const int ns=P->roiRow[i+1]-P->roiRow[i];
+        if(sp[0]<c0) c0=sp[0];
+        if(sp[2*ns-1]+maxN>c1) c1=sp[2*ns-1]+maxN;
+    }
+    if(r1>N) r1=N;
+    if(c1>N) c1=N;
+    if(r0>=r1||c0>=c1) 
+    return false;
+}
+ const int H=r1-r0, Wd=c1-c0, W=Wd+1;
+ long long* sat=(long long*)malloc((size_t)(H+1)*W*sizeof(long long));
+ if(!sat) 
+ return false;
+ int lo=P->a[r0*N+c0], hi=lo;
+ for(int c=0;c<W;++c) 
+ sat[c]=0;
+ for(int r=0;r<H;++r){
+    long long row=0;
+    sat[(r+1)*W]=0;
+    const int* src=P->a+(size_t)(r0+r)*N+c0;
+    for(int c=0;c<Wd;++c){
+        int v=src[c];
+        if(v<lo) lo=v;
+        if(v>hi) hi=v;
+        row+=v;
+        sat[(r+1)*W+c+1]=sat[r*W+c+1]+row;
+    }
+}
+ t->s=sat;
+ t->r0=r0;
+ t->c0=c0;
+ t->W=W;
+ t->minv=lo;
+ t->maxv=hi;
+ return true;
+}
+
+static inline long long sat_window(const SatTable* t,int i,int j,int n){
+ const long long* sat=t->s;
+ const int W=t->W;
+ i-=t->r0;
+ j-=t->c0;
+ return sat[(i+n)*W+j+n]-sat[i*W+j+n]-sat[(i+n)*W+j]+sat[i*W+j];
+}
+
+// Largest object that fits into the picture; the summed-area table must cover its windows.
+static int max_fitting_size(const ObjectT* objs,int M,int N){
+ int m=1;
+ for(int k=0;k<M;++k) 
+ if(objs[k].n<=N && objs[k].n>m) m=objs[k].n;
+ return m;
+}
+
+// Pixel-sampling prefilter. An object may carry a SamplePlan: a fixed random subset of its (active) pixels, 
+// the same for every window, so checking a window is one short gather loop. sample_offsets turns the 
+// sample into offsets for a picture of width N once per (picture, object).
+static int* sample_offsets(const SamplePlan* plan,int N){
+ int* off=(int*)malloc(((size_t)plan->count+1)*sizeof(int));
+ if(!off) 
+ return NULL;
+ for(int t=0;t<plan->count;++t) 
+ off[t]=plan->r[t]*N+plan->c[t];
+ return off;
+}
+
+// Decides whether window (i,j) can be skipped without calling match_position. Both variants first use the 
+// exact fact that the sampled terms alone are a lower bound of the score. The exact variant then adds a 
+// lower bound for the unseen pixels, |sum(unseen picture pixels) - sum(unseen object pixels)| / max pixel, 
+// using the summed-area table (when available) to get the window sum; it never rejects a matching window. 
+// The probabilistic variant extrapolates the sample mean to all pixels and rejects when the lower 
+// confidence bound, mean - z*sd/sqrt(S) with the finite-population correction, is already over the 
+// threshold; it can miss a match with small probability but rejects far more windows.
+static inline bool sample_rejects(const Picture* P,const SamplePlan* plan,const int* off,int n,int i,int j,double threshold,const SatTable* sat){
+ const int* base=P->a+(size_t)i*P->N+j;
+ const int* v=plan->v;
+ double part=0.0, sq=0.0;
+ long long psum=0;
+ #pragma omp simd reduction(+:part,sq,psum)
+ for(int t=0;t<plan->count;++t){
+    int pv=base[off[t]];
+    double d=fabs((double)(pv-v[t])/(double)pv);
+    part+=d;
+    sq+=d*d;
+    psum+=pv;
+}
+ if(part>=threshold) 
+ return true;
+ if(!plan->probabilistic){
+    if(!sat || plan->restSum<0) 
+    return false;
+    double rest=(double)(sat_window(sat,i,j,n)-psum-plan->restSum);
+    return part+fabs(rest)/(double)sat->maxv*(1.0-1e-12)>=threshold;
+}
+ const double S=plan->count, T=plan->total;
+ const double mean=part/S;
+ double var=S>1?(sq-S*mean*mean)/(S-1):0.0;
+ if(var<0) var=0;
+ const double fpc=T>1?sqrt((T-S)/(T-1)):0.0;
+ return T*(mean-plan->z*sqrt(var/S)*fpc)>=threshold;
+}
+
+// True when some object uses the exact sampling variant, which needs the summed-area table.
+static bool sampling_wants_sat(const ObjectT* objs,int M){
+ for(int k=0;k<M;++k) 
+ if(objs[k].sample && !objs[k].sample->probabilistic && objs[k].sample->restSum>=0) return true;
+ return false;
+}
+
+// Repetition-aware window skipping. In flat or periodic regions neighbouring windows are often pixel-
+// identical, and identical windows score the same against any object. Window (i,j) equals window (i,j-1)
+// exactly when each of the columns j-1..j+n-2 equals its right neighbour over rows i..i+n-1. The column
+// segments are compared through rolling hashes: ColumnHash keeps the prefix polynomial hash of every
+// column down the rows, so the hash of any vertical segment is two lookups, and an equal hash is then
+// confirmed by comparing the pixels, so a collision can never skip a window wrongly.
+typedef struct{
+    unsigned long long* h;   // (N+1) x N: h[r*N+c] = hash of column c over rows 0..r-1
+} 
+ColumnHash;
+
+#define COLUMN_HASH_BASE 0x100000001b3ULL
+
+static long long g_repeatSkipped, g_repeatVisited;
+
+static bool build_column_hash(const Picture* P,ColumnHash* t){
+ const int N=P->N;
+ unsigned long long* h=(unsigned long long*)malloc(((size_t)N+1)*N*sizeof(unsigned long long));
+ if(!h) 
+ return false;
+ for(int c=0;c<N;++c) 
+ h[c]=0;
+ for(int r=0;r<N;++r){
+    const int* src=P->a+(size_t)r*N;
+    for(int c=0;c<N;++c) 
+    h[(size_t)(r+1)*N+c]=h[(size_t)r*N+c]*COLUMN_HASH_BASE+(unsigned int)src[c];
+}
+ t->h=h;
+ return true;
+}
+
+// COLUMN_HASH_BASE^n, which removes the rows above a segment from its prefix hash.
+static unsigned long long column_hash_power(int n){
+ unsigned long long p=1;
+ for(int t=0;t<n;++t) 
+ p*=COLUMN_HASH_BASE;
+ return p;
+}
+
+// Fills run[c] for the n-row band starting at row i with the number of consecutive columns from c on that
+// equal their right neighbour; window (i,j) then repeats window (i,j-1) iff run[j-1] >= n.
+static void column_repeats(const Picture* P,const ColumnHash* t,unsigned long long pw,int i,int n,int* run){
+ const int N=P->N;
+ const unsigned long long* top=t->h+(size_t)i*N;
+ const unsigned long long* bot=t->h+(size_t)(i+n)*N;
+ run[N-1]=0;
+ unsigned long long right=bot[N-1]-top[N-1]*pw;
+ for(int c=N-2;c>=0;--c){
+    const unsigned long long seg=bot[c]-top[c]*pw;
+    bool same=seg==right;
+    for(int r=i;r<i+n && same;++r) 
+    same=P->a[(size_t)r*N+c]==P->a[(size_t)r*N+c+1];
+    run[c]=same?run[c+1]+1:0;
+    right=seg;
+}
+}
+
+static void count_repeats(long long skipped,long long visited){
+ __atomic_fetch_add(&g_repeatSkipped,skipped,__ATOMIC_RELAXED);
+ __atomic_fetch_add(&g_repeatVisited,visited,__ATOMIC_RELAXED);
+}
+
+// Windows visited by the first-match and all-matches searches of this process so far, and how many of
+// them were answered from the identical window to their left instead of being scored.
+void window_repeat_stats(long long* skipped,long long* visited){
+ *skipped=__atomic_load_n(&g_repeatSkipped,__ATOMIC_RELAXED);
+ *visited=__atomic_load_n(&g_repeatVisited,__ATOMIC_RELAXED);
+}
+
+// Pair prefilter. Every window term is |p-o|/p for a picture pixel p and an object pixel o, so a term can
+// never be smaller than the distance from o to the nearest value that occurs anywhere in the picture.
+// For a positive v, |v-o|/v falls towards o from both sides, so that nearest value is the next picture
+// value at or above o or the one at or below it. Summing these distances over the object's pixels bounds
+// the score of every window from below; when the bound already reaches the threshold, the (picture, object)
+// pair cannot match and its whole scan is skipped. The picture side is its sorted distinct values, built
+// once per search call; the object side is its ValueSummary, prepared once with the objects.
+typedef struct{
+    int* v;       // sorted distinct picture values, NULL when the filter is off for this picture
+    int count;
+} 
+PictureValues;
+
+static long long g_pairSkipped, g_pairTested;
+
+static int cmp_int(const void* x,const void* y){
+ int a=*(const int*)x, b=*(const int*)y;
+ return (a>b)-(a<b);
+}
+
+// Collects the distinct values of a picture, unless no object has a ValueSummary. Pixels <= 0 make the
+// per-value bound invalid, so such a picture gets no summary (the filter then passes every pair). Small
+// value ranges use a presence table, others a sorted copy.
+static void build_picture_values(const Picture* P,const ObjectT* objs,int M,PictureValues* pv){
+ pv->v=NULL;
+ pv->count=0;
+ const size_t NN=(size_t)P->N*P->N;
+ bool any=false;
+ for(int k=0;k<M && !any;++k) 
+ any=objs[k].values!=NULL;
+ if(NN==0 || !any) 
+ return;
+ int lo=P->a[0], hi=P->a[0];
+ for(size_t t=1;t<NN;++t){
+    if(P->a[t]<lo) lo=P->a[t];
+    if(P->a[t]>hi) hi=P->a[t];
+}
+ if(lo<=0) 
+ return;
+ const long long range=(long long)hi-lo+1;
+ if(range<=4*(long long)NN+4096){
+    unsigned char* seen=(unsigned char*)calloc((size_t)range,1);
+    int* v=(int*)malloc((size_t)(range<(long long)NN?range:(long long)NN)*sizeof(int));
+    if(!seen||!v){
+        free(seen);
+        free(v);
+        return;
+    }
+    for(size_t t=0;t<NN;++t) 
+    seen[P->a[t]-lo]=1;
+    int k=0;
+    for(long long x=0;x<range;++x) 
+    if(seen[x]) v[k++]=(int)(lo+x);
+    free(seen);
+    pv->v=v;
+    pv->count=k;
+    return;
+}
+ int* v=(int*)malloc(NN*sizeof(int));
+ if(!v) 
+ return;
+ memcpy(v,P->a,NN*sizeof(int));
+ qsort(v,NN,sizeof(int),cmp_int);
+ int k=0;
+ for(size_t t=0;t<NN;++t) 
+ if(k==0||v[t]!=v[k-1]) v[k++]=v[t];
+ pv->v=v;
+ pv->count=k;
+}
+
+// Lower bound of the score of any window of the pair; stops summing once 'limit' is reached.
+static double pair_lower_bound(const PictureValues* pv,const ValueSummary* s,double limit){
+ double bound=0.0;
+ for(int t=0;t<s->count && bound<limit;++t){
+    const int o=s->v[t];
+    int lo=0, hi=pv->count;
+    while(lo<hi){
+        const int mid=(lo+hi)/2;
+        if(pv->v[mid]<o) lo=mid+1; else hi=mid;
+    }
+    double d=INFINITY;
+    if(lo<pv->count) 
+    d=fabs((double)(pv->v[lo]-o)/(double)pv->v[lo]);
+    if(lo>0){
+        const double e=fabs((double)(pv->v[lo-1]-o)/(double)pv->v[lo-1]);
+        if(e<d) d=e;
+    }
+    bound+=d*s->c[t];
+}
+ return bound;
+}
+
+// True when every window of the pair (picture, object) provably scores above 'limit' (the threshold, or
+// the running best of the best-match and top-K searches). The bound is shrunk by a relative 1e-9 so that
+// rounding differences against match_position can never skip a window that would count.
+static bool pair_hopeless(const PictureValues* pv,const ObjectT* O,double limit){
+ if(!pv->v || !O->values) 
+ return false;
+ __atomic_fetch_add(&g_pairTested,1,__ATOMIC_RELAXED);
+ if(pair_lower_bound(pv,O->values,limit*2+1)*(1.0-1e-9)<=limit) 
+ return false;
+ __atomic_fetch_add(&g_pairSkipped,1,__ATOMIC_RELAXED);
+ return true;
+}
+
+// (Picture, object) pairs tested by the pair prefilter of this process so far, and how many were skipped.
+void pair_filter_stats(long long* skipped,long long* tested){
+ *skipped=__atomic_load_n(&g_pairSkipped,__ATOMIC_RELAXED);
+ *tested=__atomic_load_n(&g_pairTested,__ATOMIC_RELAXED);
+}
+
+// Object similarity pruning. At a fixed window the score is a weighted L1 distance between the window and
+// the object with weights 1/p, so by the triangle inequality score(B) >= score(A) - sum|a-b|/p, and with
+// p >= minv (the smallest picture pixel) score(B) >= score(A) - dist(A,B)/minv. Objects are grouped into
+// clusters of same-size near-duplicates around a medoid that precedes its members in the object array.
+// While the medoid is scanned, its score (or a lower bound of it) at every window is written to a plane;
+// a member then skips every window where the medoid's plane already proves it cannot match. A plane is
+// freed after the last member of its cluster.
+typedef struct{
+    double** plane;   // per object index: plane of a medoid being recorded or kept for its members
+    double invMin;    // 1/minv, 0 when the pruning is off for this picture
+} 
+ClusterPlanes;
+
+static long long g_clusterSkipped, g_clusterVisited;
+
+static void cluster_planes_init(ClusterPlanes* cp,const Picture* P,const ObjectT* objs,int M){
+ cp->plane=NULL;
+ cp->invMin=0.0;
+ bool any=false;
+ for(int k=0;k<M && !any;++k) 
+ any=objs[k].cluster && objs[k].cluster->leader>=0;
+ const size_t NN=(size_t)P->N*P->N;
+ if(!any || NN==0) 
+ return;
+ int lo=P->a[0];
+ for(size_t t=1;t<NN;++t) 
+ if(P->a[t]<lo) lo=P->a[t];
+ if(lo<=0) 
+ return;
+ cp->plane=(double**)calloc((size_t)M,sizeof(double*));
+ if(cp->plane) 
+ cp->invMin=1.0/(double)lo;
+}
+
+// Plane to record while scanning object k: allocated for a medoid that has members, NULL otherwise.
+static double* cluster_record(ClusterPlanes* cp,const ObjectT* objs,int k,int N){
+ const ObjectCluster* c=objs[k].cluster;
+ if(!cp->plane || !c || c->leader>=0) 
+ return NULL;
+ const size_t W=(size_t)(N-objs[k].n+1);
+ cp->plane[k]=(double*)malloc(W*W*sizeof(double));
+ return cp->plane[k];
+}
+
+// Plane of the medoid of object O (NULL when O is no member or the medoid was not fully scanned) and the
+// amount its scores are lowered by for O.
+static const double* cluster_anchor(const ClusterPlanes* cp,const ObjectT* O,double* slack){
+ const ObjectCluster* c=O->cluster;
+ if(!cp->plane || !c || c->leader<0) 
+ return NULL;
+ *slack=(double)c->dist*cp->invMin;
+ return cp->plane[c->leader];
+}
+
+// True when the medoid's score 'a' at a window proves the member cannot score below the threshold there.
+// The medoid score is shrunk by a relative 1e-9 to stay on the safe side of rounding.
+static inline bool cluster_prunes(double a,double slack,double threshold){
+ return a*(1.0-1e-9)-slack>=threshold;
+}
+
+// Called after object k: frees the medoid's plane once its last member is done (or right away when the
+// medoid itself was cut short).
+static void cluster_done(ClusterPlanes* cp,const ObjectT* objs,int k,bool complete){
+ const ObjectCluster* c=objs[k].cluster;
+ if(!cp->plane || !c) 
+ return;
+ if(c->leader<0 && !complete){
+    free(cp->plane[k]);
+    cp->plane[k]=NULL;
+}
+ if(c->leader>=0 && objs[c->leader].cluster->lastMember==k){
+    free(cp->plane[c->leader]);
+    cp->plane[c->leader]=NULL;
+}
+}
+
+static void cluster_planes_free(ClusterPlanes* cp,int M){
+ if(!cp->plane) 
+ return;
+ for(int k=0;k<M;++k) 
+ free(cp->plane[k]);
+ free(cp->plane);
+ cp->plane=NULL;
+}
+
+static void count_cluster(long long skipped,long long visited){
+ if(visited==0) 
+ return;
+ __atomic_fetch_add(&g_clusterSkipped,skipped,__ATOMIC_RELAXED);
+ __atomic_fetch_add(&g_clusterVisited,visited,__ATOMIC_RELAXED);
+}
+
+// Windows of cluster members visited by the first-match and all-matches searches of this process so far,
+// and how many of them the medoid's plane ruled out.
+void cluster_prune_stats(long long* skipped,long long* visited){
+ *skipped=__atomic_load_n(&g_clusterSkipped,__ATOMIC_RELAXED);
+ *visited=__atomic_load_n(&g_clusterVisited,__ATOMIC_RELAXED);
+}
+
 // This function searches through a picture to find if any of the given objects appear in it. 
 // It tries each object one by one, and for each object, it checks every possible position where 
 // the object could fit in the picture. It uses multiple CPU threads (OpenMP) to check many positions 
@@ -35,59 +663,2076 @@ bool find_match_for_picture(const Picture* P,const ObjectT* objs,int M,double th
     out->objectId  = -1;
     out->posI      = -1;
     out->posJ      = -1;
+    out->score     = 0.0;
+    out->orientation = 0;
 
     const int N = P->N;
+    // Work of other engines is in the slots still; it counts towards the total only, not this picture
+    HOT_COLLECT(-1);
+    const double trPic = trace_begin(TRACE_PICTURE, P->id);
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+    SatTable sat = { NULL, 0, 0, 0, 0, 0 };
+    const bool haveSat = sampling_wants_sat(objs, M) && build_sat(P, max_fitting_size(objs, M, N), &sat) && sat.minv > 0;
+    // Repeated windows (see column_repeats): one run buffer of N ints per thread
+    ColumnHash ch = { NULL };
+    int* runs = (int*)malloc((size_t)omp_get_max_threads() * N * sizeof(int));
+    if (runs && !build_column_hash(P, &ch)) { free(runs); runs = NULL; }
+    ClusterPlanes cp;
+    cluster_planes_init(&cp, P, objs, M);
 
     for (int k = 0; k < M; ++k) {
         const ObjectT* O = &objs[k];
         const int n = O->n;
-        if (n > N) continue;
+        if (n > N || pair_hopeless(&pv, O, threshold)) {
+            HOT_ONLY(if (n <= N) HOT_ADD(pairs, 1);)
+            HOT_COLLECT(k);
+            cluster_done(&cp, objs, k, false);
+            continue;
+        }
 
         const int maxI = N - n;
         const int maxJ = N - n;
+        int* off = O->sample ? sample_offsets(O->sample, N) : NULL;
+        const unsigned long long pw = column_hash_power(n);
+        // Similarity pruning: a medoid records its scores, a member reads its medoid's
+        const int W = maxJ + 1;
+        double* rec = cluster_record(&cp, objs, k, N);
+        double slack = 0.0;
+        const double* anc = cluster_anchor(&cp, O, &slack);
+        const double trObj = trace_begin(TRACE_OBJECT, O->id);
 
         int foundFlag = 0;   // shared among tasks for this object
         int winI = -1, winJ = -1;
+        double winScore = 0.0;
 
         #pragma omp parallel
         {
             #pragma omp single nowait
             {
                 for (int i = 0; i <= maxI; ++i) {
-                    #pragma omp task firstprivate(i) shared(foundFlag, winI, winJ, P, O, threshold, maxJ, N)
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i) shared(foundFlag, winI, winJ, winScore, P, O, threshold, maxJ, N, off, sat, ch, runs, pw, rec, anc, slack)
                     {
+                        const double trRow = trace_begin(TRACE_ROW, i);
+                        int full[2];
+                        const int* sp;
+                        const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                        int* run = runs ? runs + (size_t)omp_get_thread_num() * N : NULL;
+                        if (run) column_repeats(P, &ch, pw, i, n, run);
+                        long long skipped = 0, visited = 0, pruned = 0, members = 0;
+                        const size_t row = (size_t)i * W;
+                        HOT_ONLY(if (__atomic_load_n(&foundFlag, __ATOMIC_RELAXED)) HOT_ADD(cancelled, 1);)
                         // If someone already found a match, this task does nothing
-                        if (!__atomic_load_n(&foundFlag, __ATOMIC_RELAXED)) {
+                        for (int s = 0; s < ns && !__atomic_load_n(&foundFlag, __ATOMIC_RELAXED); ++s) {
+                            const int j1 = sp[2 * s + 1] < maxJ ? sp[2 * s + 1] : maxJ;
 
-                            for (int j = 0; j <= maxJ; ++j) {
-                                if (__atomic_load_n(&foundFlag, __ATOMIC_RELAXED)) break;
+                            for (int j = sp[2 * s]; j <= j1; ++j) {
+                                if (__atomic_load_n(&foundFlag, __ATOMIC_RELAXED)) { HOT_ADD(cancelled, 1); break; }
+                                visited++;
+                                // Same pixels as window (i,j-1), which did not match either
+                                if (run && j > sp[2 * s] && run[j - 1] >= n) {
+                                    skipped++;
+                                    if (rec) rec[row + j] = rec[row + j - 1];
+                                    continue;
+                                }
+                                if (anc) {
+                                    members++;
+                                    if (cluster_prunes(anc[row + j], slack, threshold)) { pruned++; continue; }
+                                }
+
+                                // An exact sample rejection proves score >= threshold, a probabilistic one nothing
+                                if (off && sample_rejects(P, O->sample, off, n, i, j, threshold, haveSat ? &sat : NULL)) {
+                                    if (rec) rec[row + j] = O->sample->probabilistic ? 0.0 : threshold;
+                                    HOT_ADD(sampled, 1);
+                                    continue;
+                                }
 
                                 double sum = match_position(P, O, i, j);
+                                if (rec) rec[row + j] = sum;
                                 if (sum < threshold) {
                                     int expected = 0;
                                     if (__atomic_compare_exchange_n(&foundFlag, &expected, 1, 0,
                                                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
                                         winI = i;
                                         winJ = j;
+                                        winScore = sum;
                                     }
                                     break; // stop scanning j once a match is seen
                                 }
                             }
                         }
+                        count_repeats(skipped, visited);
+                        count_cluster(pruned, members);
+                        HOT_ADD(repeated, skipped);
+                        HOT_ADD(clustered, pruned);
+                        trace_end(TRACE_ROW, i, trRow);
                     } // task
                 }     // for i
             } // single
             #pragma omp taskwait
         } // parallel
+        free(off);
+        HOT_COLLECT(k);
+        trace_end(TRACE_OBJECT, O->id, trObj);
 
         if (foundFlag) {
             out->found    = 1;
             out->objectId = O->id;
             out->posI     = winI;
             out->posJ     = winJ;
+            out->score    = winScore;
+            free(sat.s);
+            free(ch.h);
+            free(runs);
+            free(pv.v);
+            cluster_planes_free(&cp, M);
+            HOT_PICTURE(P->id);
+            trace_end(TRACE_PICTURE, P->id, trPic);
             return true; // picture done when any object matches
         }
+        cluster_done(&cp, objs, k, true);
     }
 
+    free(sat.s);
+    free(ch.h);
+    free(runs);
+    free(pv.v);
+    cluster_planes_free(&cp, M);
+    HOT_PICTURE(P->id);
+    trace_end(TRACE_PICTURE, P->id, trPic);
     return false; // no object matched this picture
-}
\ No newline at end of file
+}
+
+// True when (i,j) is an allowed top-left position of the picture's ROI (always true without one).
+static inline bool roi_allows(const Picture* P,int i,int j){
+ if(!P->roiRow) 
+ return true;
+ const int* sp=P->roiSpan+2*P->roiRow[i];
+ const int ns=P->roiRow[i+1]-P->roiRow[i];
+ for(int s=0;s<ns;++s) 
+ if(j>=sp[2*s] && j<=sp[2*s+1]) return true;
+ return false;
+}
+
+// Position t of ring d around (ci,cj) in a fixed order: top row, bottom row, then the left and right 
+// columns without their corners. Ring 0 is the centre alone, ring d has 8d positions.
+static inline void ring_position(int d,int t,int ci,int cj,int* i,int* j){
+ if(d==0){ *i=ci; *j=cj; }
+ else if(t<2*d+1){ *i=ci-d; *j=cj-d+t; }
+ else if(t<4*d+2){ *i=ci+d; *j=cj-d+(t-2*d-1); }
+ else if(t<6*d+1){ *i=ci-d+1+(t-4*d-2); *j=cj-d; }
+ else { *i=ci-d+1+(t-6*d-1); *j=cj+d; }
+}
+
+// This function is the temporal-coherence probe for picture sequences: it only looks for the object with 
+// id 'objectId' and visits its windows in expanding square rings around (ci,cj), the position where the 
+// object was found in the previous frame: ring 0 is the centre, ring d the 8d positions at Chebyshev 
+// distance d, up to ring 'radius'. Every ring is scored in parallel and the hit closest to the centre 
+// (lowest ring, then lowest position in ring order) wins, so a coherent stream finds its match after 
+// scoring a handful of windows instead of everything before it in row-major order. Returns false if the 
+// object has no match inside the radius; the caller then falls back to the exhaustive search.
+bool find_match_near(const Picture* P,const ObjectT* objs,int M,double threshold,int objectId,int ci,int cj,int radius,MatchResult* out){
+ out->pictureId=P->id;
+ out->found=0;
+ out->objectId=-1;
+ out->posI=-1;
+ out->posJ=-1;
+ out->score=0.0;
+ out->orientation=0;
+ const ObjectT* O=NULL;
+ for(int k=0;k<M && !O;++k) 
+ if(objs[k].id==objectId) O=&objs[k];
+ if(!O || O->n>P->N) 
+ return false;
+ const int maxIJ=P->N-O->n;
+ if(ci>maxIJ) ci=maxIJ;
+ if(cj>maxIJ) cj=maxIJ;
+ if(ci<0) ci=0;
+ if(cj<0) cj=0;
+ for(int d=0;d<=radius;++d){
+    const int cnt=d==0?1:8*d;
+    int best=cnt;
+    double bestScore=0.0;
+    #pragma omp parallel for schedule(dynamic,8) if(cnt>=64)
+    for(int t=0;t<cnt;++t){
+        int i, j;
+        ring_position(d,t,ci,cj,&i,&j);
+        if(i<0 || j<0 || i>maxIJ || j>maxIJ || !roi_allows(P,i,j)) 
+        continue;
+        if(t>__atomic_load_n(&best,__ATOMIC_RELAXED)) 
+        continue;
+        double sc=match_position_bounded(P,O,i,j,threshold);
+        if(sc<threshold){
+            #pragma omp critical(near_best)
+            if(t<best){
+                __atomic_store_n(&best,t,__ATOMIC_RELAXED);
+                bestScore=sc;
+            }
+        }
+    }
+    if(best<cnt){
+        int i, j;
+        ring_position(d,best,ci,cj,&i,&j);
+        out->found=1;
+        out->objectId=O->id;
+        out->posI=i;
+        out->posJ=j;
+        out->score=bestScore;
+        return true;
+    }
+    // Stop once the ring lies completely outside the picture
+    if(ci-d<=0 && cj-d<=0 && ci+d>=maxIJ && cj+d>=maxIJ) 
+    break;
+}
+ return false;
+}
+
+// Per-thread append buffer for the all-matches search. Every OpenMP thread owns exactly one of these,
+// so appending a hit is a plain store with no atomics or locks on the hot path. The struct is padded
+// to a cache line so that two threads bumping their counters never share a line.
+typedef struct{
+    MatchHit* a;
+    int n;
+    int cap;
+    int failed;
+    char pad[64-sizeof(MatchHit*)-3*sizeof(int)];
+} 
+HitBuf;
+
+static inline void hitbuf_push(HitBuf* b,int objectId,int i,int j){
+ if(b->n==b->cap){
+    int cap=b->cap?b->cap*2:1024;
+    MatchHit* a=(MatchHit*)realloc(b->a,(size_t)cap*sizeof(MatchHit));
+    if(!a){
+        b->failed=1;
+        return;
+    }
+    b->a=a;
+    b->cap=cap;
+}
+ b->a[b->n].objectId=objectId;
+ b->a[b->n].posI=i;
+ b->a[b->n].posJ=j;
+ b->n++;
+}
+
+// This helper moves the hits of one object from the per-thread buffers into the picture's result list. 
+// Each row i is scanned by exactly one task, so the hits of a row are already contiguous and sorted by j 
+// inside one thread buffer. A counting sort on the row index is therefore enough to produce (i,j) order 
+// in linear time, which matters when a flat picture produces millions of hits. Buffers are emptied 
+// (but keep their memory) so the next object can reuse them. Returns false if memory runs out.
+static bool merge_hit_buffers(HitBuf* bufs,int nbufs,int maxI,MatchList* out){
+ int total=0;
+ for(int t=0;t<nbufs;++t) 
+ total+=bufs[t].n;
+ if(total==0) 
+ return true;
+ if(out->count+total>out->cap){
+    int cap=out->cap?out->cap:1024;
+    while(cap<out->count+total) cap*=2;
+    MatchHit* h=(MatchHit*)realloc(out->hits,(size_t)cap*sizeof(MatchHit));
+    if(!h) 
+    return false;
+    out->hits=h;
+    out->cap=cap;
+}
+ int* rowStart=(int*)calloc((size_t)maxI+2,sizeof(int));
+ if(!rowStart) 
+ return false;
+ for(int t=0;t<nbufs;++t)
+  for(int h=0;h<bufs[t].n;++h) 
+  rowStart[bufs[t].a[h].posI+1]++;
+ for(int i=0;i<=maxI;++i) 
+ rowStart[i+1]+=rowStart[i];
+ MatchHit* dst=out->hits+out->count;
+ for(int t=0;t<nbufs;++t){
+    for(int h=0;h<bufs[t].n;++h) 
+    dst[rowStart[bufs[t].a[h].posI]++]=bufs[t].a[h];
+    bufs[t].n=0;
+}
+ out->count+=total;
+ free(rowStart);
+ return true;
+}
+
+// This function is the all-matches version of find_match_for_picture. Instead of stopping at the first 
+// hit it records every position of every object whose score is below the threshold. The search is split 
+// the same way (one OpenMP task per candidate row), but each thread appends hits into its own buffer so 
+// nothing is shared while scoring. After each object the buffers are merged into 'out', which ends up 
+// sorted by object (input order), then row i, then column j. Returns the number of hits, or -1 if memory 
+// for the hits could not be allocated.
+int find_all_matches_for_picture(const Picture* P,const ObjectT* objs,int M,double threshold,MatchList* out){
+    out->pictureId = P->id;
+    out->count     = 0;
+
+    const int N = P->N;
+    const double trPic = trace_begin(TRACE_PICTURE, P->id);
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+    const int nthreads = omp_get_max_threads();
+    HitBuf* bufs = (HitBuf*)calloc((size_t)nthreads, sizeof(HitBuf));
+    if (!bufs) { free(pv.v); return -1; }
+    bool ok = true;
+    SatTable sat = { NULL, 0, 0, 0, 0, 0 };
+    const bool haveSat = sampling_wants_sat(objs, M) && build_sat(P, max_fitting_size(objs, M, N), &sat) && sat.minv > 0;
+    ColumnHash ch = { NULL };
+    int* runs = (int*)malloc((size_t)nthreads * N * sizeof(int));
+    if (runs && !build_column_hash(P, &ch)) { free(runs); runs = NULL; }
+    ClusterPlanes cp;
+    cluster_planes_init(&cp, P, objs, M);
+
+    for (int k = 0; k < M && ok; ++k) {
+        const ObjectT* O = &objs[k];
+        const int n = O->n;
+        if (n > N || pair_hopeless(&pv, O, threshold)) { cluster_done(&cp, objs, k, false); continue; }
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+        int* off = O->sample ? sample_offsets(O->sample, N) : NULL;
+        const unsigned long long pw = column_hash_power(n);
+        const int W = maxJ + 1;
+        double* rec = cluster_record(&cp, objs, k, N);
+        double slack = 0.0;
+        const double* anc = cluster_anchor(&cp, O, &slack);
+        const double trObj = trace_begin(TRACE_OBJECT, O->id);
+
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i) shared(bufs, P, O, threshold, maxJ, off, sat, ch, runs, pw, rec, anc, slack)
+                    {
+                        const double trRow = trace_begin(TRACE_ROW, i);
+                        HitBuf* b = &bufs[omp_get_thread_num()];
+                        int full[2];
+                        const int* sp;
+                        const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                        int* run = runs ? runs + (size_t)omp_get_thread_num() * N : NULL;
+                        if (run) column_repeats(P, &ch, pw, i, n, run);
+                        long long skipped = 0, visited = 0, pruned = 0, members = 0;
+                        const size_t row = (size_t)i * W;
+                        for (int s = 0; s < ns; ++s) {
+                            const int j1 = sp[2 * s + 1] < maxJ ? sp[2 * s + 1] : maxJ;
+                            bool hit = false;   // answer of window (i,j-1)
+                            for (int j = sp[2 * s]; j <= j1; ++j) {
+                                visited++;
+                                if (run && j > sp[2 * s] && run[j - 1] >= n) {
+                                    skipped++;
+                                    if (rec) rec[row + j] = rec[row + j - 1];
+                                    if (hit) hitbuf_push(b, O->id, i, j);
+                                    continue;
+                                }
+                                if (anc) {
+                                    members++;
+                                    if (cluster_prunes(anc[row + j], slack, threshold)) { pruned++; hit = false; continue; }
+                                }
+                                // A rejected window records a lower bound only (see find_match_for_picture)
+                                const bool rejected = off && sample_rejects(P, O->sample, off, n, i, j, threshold, haveSat ? &sat : NULL);
+                                const double sum = rejected ? (O->sample->probabilistic ? 0.0 : threshold) : match_position(P, O, i, j);
+                                if (rec) rec[row + j] = sum;
+                                hit = !rejected && sum < threshold;
+                                if (hit) hitbuf_push(b, O->id, i, j);
+                            }
+                        }
+                        count_repeats(skipped, visited);
+                        count_cluster(pruned, members);
+                        trace_end(TRACE_ROW, i, trRow);
+                    } // task
+                }     // for i
+            } // single
+            #pragma omp taskwait
+        } // parallel
+        free(off);
+
+        for (int t = 0; t < nthreads; ++t)
+            if (bufs[t].failed) ok = false;
+        if (ok) ok = merge_hit_buffers(bufs, nthreads, maxI, out);
+        cluster_done(&cp, objs, k, true);
+        trace_end(TRACE_OBJECT, O->id, trObj);
+    }
+
+    for (int t = 0; t < nthreads; ++t) free(bufs[t].a);
+    free(bufs);
+    free(sat.s);
+    free(ch.h);
+    free(runs);
+    free(pv.v);
+    cluster_planes_free(&cp, M);
+    trace_end(TRACE_PICTURE, P->id, trPic);
+    return ok ? out->count : -1;
+}
+
+// Releases the hit array owned by a MatchList and resets it to the empty state.
+void match_list_free(MatchList* l){
+ free(l->hits);
+ l->hits=NULL;
+ l->count=0;
+ l->cap=0;
+}
+
+// Lock-free helpers for a shared double that only ever decreases (the running best score). Reads are 
+// relaxed: a stale value is only a looser bound, never a wrong answer. Updates use a CAS loop that 
+// retries only while our value is still smaller than the published one.
+static inline double bound_load(double* b){
+ double v;
+ __atomic_load(b,&v,__ATOMIC_RELAXED);
+ return v;
+}
+
+static inline void bound_lower(double* b,double v){
+ double cur;
+ __atomic_load(b,&cur,__ATOMIC_RELAXED);
+ while(v<cur && !__atomic_compare_exchange(b,&cur,&v,false,__ATOMIC_RELAXED,__ATOMIC_RELAXED)){}
+}
+
+// Per-thread best candidate of the best-match search, padded to a cache line.
+typedef struct{
+    double score;
+    int k;
+    int i;
+    int j;
+    char pad[64-sizeof(double)-3*sizeof(int)];
+} 
+BestSlot;
+
+// Ordering used to pick the best candidates: lower score wins, ties go to the earlier object, then the 
+// smaller row and column, so the answer does not depend on thread timing.
+static inline bool cand_less(double s1,int k1,int i1,int j1,double s2,int k2,int i2,int j2){
+ if(s1!=s2) 
+ return s1<s2;
+ if(k1!=k2) 
+ return k1<k2;
+ if(i1!=i2) 
+ return i1<i2;
+ return j1<j2;
+}
+
+static inline bool better_candidate(double s,int k,int i,int j,const BestSlot* b){
+ return cand_less(s,k,i,j,b->score,b->k,b->i,b->j);
+}
+
+// This function finds the single lowest-scoring (object, position) of a picture whose score is below 
+// the threshold. It is a branch-and-bound search: the best score found so far is kept in one shared 
+// double that all tasks read and lower without locks, and it carries over from one object to the next. 
+// Every window is first checked against a cheap lower bound taken from the summed-area table 
+// (score >= |sum(window) - sum(object)| / max pixel, valid because all pixels are positive), and then 
+// scored with match_position_bounded, which abandons it as soon as it is worse than the running best. 
+// Each thread remembers its own best candidate and they are reduced at the end. Windows are only pruned 
+// when strictly worse than the bound, so ties are always resolved the same way. Returns true if any 
+// window scored below the threshold.
+bool find_best_match_for_picture(const Picture* P,const ObjectT* objs,int M,double threshold,MatchResult* out){
+    out->pictureId = P->id;
+    out->found     = 0;
+    out->objectId  = -1;
+    out->posI      = -1;
+    out->posJ      = -1;
+    out->score     = 0.0;
+    out->orientation = 0;
+
+    const int N = P->N;
+    const double trPic = trace_begin(TRACE_PICTURE, P->id);
+    SatTable sat = { NULL, 0, 0, 0, 0, 0 };
+    const bool useLB = build_sat(P, max_fitting_size(objs, M, N), &sat) && sat.minv > 0;
+    const double invMax = useLB ? 1.0 / (double)sat.maxv : 0.0;
+
+    const int nthreads = omp_get_max_threads();
+    BestSlot* slots = (BestSlot*)calloc((size_t)nthreads, sizeof(BestSlot));
+    if (!slots) { free(sat.s); return false; }
+    for (int t = 0; t < nthreads; ++t) { slots[t].score = INFINITY; slots[t].k = M; }
+
+    double bound = threshold; // shared running best, only decreases
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+
+    for (int k = 0; k < M; ++k) {
+        const ObjectT* O = &objs[k];
+        const int n = O->n;
+        if (n > N) continue;
+        if (pair_hopeless(&pv, O, bound_load(&bound))) continue;
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+        long long objSum = 0;
+        for (int t = 0; t < n * n; ++t) objSum += O->a[t];
+        const double trObj = trace_begin(TRACE_OBJECT, O->id);
+
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i, k) shared(bound, slots, sat, P, O, maxJ, objSum)
+                    {
+                        const double trRow = trace_begin(TRACE_ROW, i);
+                        BestSlot* b = &slots[omp_get_thread_num()];
+                        int full[2];
+                        const int* sp;
+                        const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                        for (int e = 0; e < ns; ++e) {
+                            const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                            for (int j = sp[2 * e]; j <= j1; ++j) {
+                                double lim = bound_load(&bound);
+                                if (useLB && !O->maskRow) {
+                                    double lb = fabs((double)(sat_window(&sat, i, j, n) - objSum)) * invMax;
+                                    if (lb * (1.0 - 1e-12) > lim) continue;
+                                }
+                                double s = match_position_bounded(P, O, i, j, lim);
+                                if (s < threshold && s <= lim && better_candidate(s, k, i, j, b)) {
+                                    b->score = s; b->k = k; b->i = i; b->j = j;
+                                    bound_lower(&bound, s);
+                                }
+                            }
+                        }
+                        trace_end(TRACE_ROW, i, trRow);
+                    } // task
+                }     // for i
+            } // single
+            #pragma omp taskwait
+        } // parallel
+        trace_end(TRACE_OBJECT, O->id, trObj);
+    }
+
+    BestSlot best = { INFINITY, M, 0, 0, {0} };
+    for (int t = 0; t < nthreads; ++t)
+        if (slots[t].k < M && better_candidate(slots[t].score, slots[t].k, slots[t].i, slots[t].j, &best))
+            best = slots[t];
+    free(slots);
+    free(sat.s);
+    free(pv.v);
+    trace_end(TRACE_PICTURE, P->id, trPic);
+
+    if (best.k < M) {
+        out->found    = 1;
+        out->objectId = objs[best.k].id;
+        out->posI     = best.i;
+        out->posJ     = best.j;
+        out->score    = best.score;
+        return true;
+    }
+    return false;
+}
+
+// Per-thread bounded max-heap for the top-K search. The root is the worst of the K candidates kept by 
+// this thread; its score is what the thread publishes as the shared abandonment bound once it is full. 
+// While the heap runs, ScoredMatch.objectId holds the object index so ties can be ordered by input order.
+typedef struct{
+    ScoredMatch* a;
+    int n;
+    char pad[64-sizeof(ScoredMatch*)-sizeof(int)];
+} 
+TopHeap;
+
+static inline bool scored_less(const ScoredMatch* x,const ScoredMatch* y){
+ return cand_less(x->score,x->objectId,x->posI,x->posJ,y->score,y->objectId,y->posI,y->posJ);
+}
+
+static void topheap_sift_up(ScoredMatch* a,int c){
+ while(c>0){
+    int p=(c-1)/2;
+    if(!scored_less(&a[p],&a[c])) 
+    break;
+    ScoredMatch t=a[p]; a[p]=a[c]; a[c]=t;
+    c=p;
+}
+}
+
+static void topheap_sift_down(ScoredMatch* a,int n,int p){
+ for(;;){
+    int l=2*p+1, r=l+1, m=p;
+    if(l<n && scored_less(&a[m],&a[l])) m=l;
+    if(r<n && scored_less(&a[m],&a[r])) m=r;
+    if(m==p) 
+    break;
+    ScoredMatch t=a[p]; a[p]=a[m]; a[m]=t;
+    p=m;
+}
+}
+
+// Offers a candidate to a heap of capacity K. Returns true when the heap is full afterwards and its 
+// root (the K-th best score of this thread) may have improved.
+static inline bool topheap_offer(TopHeap* h,int K,double s,int k,int i,int j){
+ ScoredMatch c={s,k,i,j};
+ if(h->n<K){
+    h->a[h->n]=c;
+    topheap_sift_up(h->a,h->n++);
+    return h->n==K;
+}
+ if(!scored_less(&c,&h->a[0])) 
+ return false;
+ h->a[0]=c;
+ topheap_sift_down(h->a,K,0);
+ return true;
+}
+
+static int cmp_scored(const void* x,const void* y){
+ const ScoredMatch* a=(const ScoredMatch*)x;
+ const ScoredMatch* b=(const ScoredMatch*)y;
+ if(scored_less(a,b)) 
+ return -1;
+ return scored_less(b,a)?1:0;
+}
+
+// This function finds the K lowest-scoring (object, position) candidates of a picture whose score is 
+// below the threshold and writes them to 'out' (room for K entries) in ascending score order. It works 
+// like find_best_match_for_picture, but every thread keeps a bounded max-heap of its K best candidates. 
+// As soon as a thread's heap is full, its root score is an upper bound of the K-th best score of the 
+// whole picture (the picture has at least these K better candidates), so it is published through the 
+// same lock-free shared bound and used for the summed-area-table bound and for early abandonment. At 
+// the end the heaps are concatenated, sorted and cut to K. Each thread heap costs O(log K) per accepted 
+// candidate, which stays cheap for K in the thousands. Returns the number of candidates written, or -1 
+// if memory runs out.
+int find_topk_matches_for_picture(const Picture* P,const ObjectT* objs,int M,double threshold,int K,ScoredMatch* out){
+    const int N = P->N;
+    SatTable sat = { NULL, 0, 0, 0, 0, 0 };
+    const bool useLB = build_sat(P, max_fitting_size(objs, M, N), &sat) && sat.minv > 0;
+    const double invMax = useLB ? 1.0 / (double)sat.maxv : 0.0;
+
+    const int nthreads = omp_get_max_threads();
+    TopHeap* heaps = (TopHeap*)calloc((size_t)nthreads, sizeof(TopHeap));
+    ScoredMatch* pool = (ScoredMatch*)malloc((size_t)nthreads * (size_t)K * sizeof(ScoredMatch));
+    if (!heaps || !pool) { free(heaps); free(pool); free(sat.s); return -1; }
+    for (int t = 0; t < nthreads; ++t) heaps[t].a = pool + (size_t)t * K;
+
+    double bound = threshold; // shared K-th best bound, only decreases
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+
+    for (int k = 0; k < M; ++k) {
+        const ObjectT* O = &objs[k];
+        const int n = O->n;
+        if (n > N) continue;
+        if (pair_hopeless(&pv, O, bound_load(&bound))) continue;
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+        long long objSum = 0;
+        for (int t = 0; t < n * n; ++t) objSum += O->a[t];
+
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i, k) shared(bound, heaps, sat, P, O, maxJ, objSum, K)
+                    {
+                        TopHeap* h = &heaps[omp_get_thread_num()];
+                        int full[2];
+                        const int* sp;
+                        const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                        for (int e = 0; e < ns; ++e) {
+                            const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                            for (int j = sp[2 * e]; j <= j1; ++j) {
+                                double lim = bound_load(&bound);
+                                if (useLB && !O->maskRow) {
+                                    double lb = fabs((double)(sat_window(&sat, i, j, n) - objSum)) * invMax;
+                                    if (lb * (1.0 - 1e-12) > lim) continue;
+                                }
+                                double s = match_position_bounded(P, O, i, j, lim);
+                                if (s < threshold && s <= lim && topheap_offer(h, K, s, k, i, j))
+                                    bound_lower(&bound, h->a[0].score);
+                            }
+                        }
+                    } // task
+                }     // for i
+            } // single
+            #pragma omp taskwait
+        } // parallel
+    }
+    free(sat.s);
+    free(pv.v);
+
+    // Compact all heaps to the front of the pool, sort and keep the K best.
+    int total = 0;
+    for (int t = 0; t < nthreads; ++t) {
+        for (int e = 0; e < heaps[t].n; ++e) pool[total + e] = heaps[t].a[e];
+        total += heaps[t].n;
+    }
+    qsort(pool, (size_t)total, sizeof(ScoredMatch), cmp_scored);
+    if (total > K) total = K;
+    for (int e = 0; e < total; ++e) {
+        out[e] = pool[e];
+        out[e].objectId = objs[pool[e].objectId].id;
+    }
+    free(pool);
+    free(heaps);
+    return total;
+}
+
+// Lowers a shared int to 'v' if 'v' is smaller, without locks.
+static inline void atomic_min_int(int* p,int v){
+ int cur=__atomic_load_n(p,__ATOMIC_RELAXED);
+ while(v<cur && !__atomic_compare_exchange_n(p,&cur,v,false,__ATOMIC_RELAXED,__ATOMIC_RELAXED)){}
+}
+
+// Largest threshold that still matters for a window with linear index 'lin': a threshold is only open 
+// if no earlier window (in row-major order) has already matched it. Returns -INFINITY when no threshold 
+// is open, which means the rest of the row can be skipped.
+static inline double sweep_limit(const double* thr,int* bestLin,int T,int lin){
+ double lim=-INFINITY;
+ for(int x=0;x<T;++x)
+  if(lin<__atomic_load_n(&bestLin[x],__ATOMIC_RELAXED) && thr[x]>lim) 
+  lim=thr[x];
+ return lim;
+}
+
+// This function answers the first-match question for several thresholds in one pass over the windows. 
+// For every threshold x, out[x] receives the first object (input order) that has a window with score 
+// below thresholds[x], at its first such position in row-major order. Objects are tried in order and a 
+// threshold is closed as soon as an object matches it, so later objects are only scanned for the 
+// thresholds that are still open. Each window is scored once with match_position_bounded, cut off at the 
+// largest threshold that is still open for it, and the score is then credited to every threshold it 
+// satisfies. Per threshold the earliest matching window is kept in a shared int updated with a lock-free 
+// minimum; windows after that position can no longer change the answer, so rows stop early when all open 
+// thresholds are settled before them. Returns true if at least one threshold found a match.
+bool find_first_matches_multi(const Picture* P,const ObjectT* objs,int M,const double* thresholds,int T,MatchResult* out){
+    const int N = P->N;
+    int* bestLin = (int*)malloc((size_t)T * sizeof(int));
+    bool* done = (bool*)calloc((size_t)T, sizeof(bool));
+    int open = T;
+    for (int x = 0; x < T; ++x) {
+        out[x].pictureId = P->id;
+        out[x].found     = 0;
+        out[x].objectId  = -1;
+        out[x].posI      = -1;
+        out[x].posJ      = -1;
+        out[x].score     = 0.0;
+        out[x].orientation = 0;
+    }
+    if (!bestLin || !done) { free(bestLin); free(done); return false; }
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+
+    for (int k = 0; k < M && open > 0; ++k) {
+        const ObjectT* O = &objs[k];
+        const int n = O->n;
+        if (n > N) continue;
+        double openMax = -INFINITY;
+        for (int x = 0; x < T; ++x)
+            if (!done[x] && thresholds[x] > openMax) openMax = thresholds[x];
+        if (pair_hopeless(&pv, O, openMax)) continue;
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+        const int W = maxJ + 1;
+        for (int x = 0; x < T; ++x) bestLin[x] = done[x] ? -1 : INT_MAX;
+
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i) shared(bestLin, thresholds, T, P, O, maxJ, W)
+                    {
+                        int full[2];
+                        const int* sp;
+                        const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                        bool open = true;
+                        for (int e = 0; e < ns && open; ++e) {
+                            const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                            for (int j = sp[2 * e]; j <= j1; ++j) {
+                                const int lin = i * W + j;
+                                double lim = sweep_limit(thresholds, bestLin, T, lin);
+                                if (lim == -INFINITY) { open = false; break; }
+                                double s = match_position_bounded(P, O, i, j, lim);
+                                if (s < lim) {
+                                    for (int x = 0; x < T; ++x)
+                                        if (s < thresholds[x]) atomic_min_int(&bestLin[x], lin);
+                                }
+                            }
+                        }
+                    } // task
+                }     // for i
+            } // single
+            #pragma omp taskwait
+        } // parallel
+
+        for (int x = 0; x < T; ++x) {
+            if (done[x] || bestLin[x] == INT_MAX) continue;
+            const int i = bestLin[x] / W, j = bestLin[x] % W;
+            out[x].found    = 1;
+            out[x].objectId = O->id;
+            out[x].posI     = i;
+            out[x].posJ     = j;
+            out[x].score    = match_position(P, O, i, j);
+            done[x] = true;
+            --open;
+        }
+    }
+
+    free(bestLin);
+    free(done);
+    free(pv.v);
+    return open < T;
+}
+
+// This function runs the (picture, object) pair searches listed in 'pairs' and writes one result per pair 
+// to 'out'. A pair index is picture*M + object (a long long, as P*M may exceed INT_MAX), so the caller 
+// can hand out any subset of the flat P*M pair space. Every pair is an independent first-match search: the answer is its first window in 
+// row-major order with a score below the threshold. To keep all threads busy even when there are only a 
+// few large pairs, each pair is cut into bands of rows and every band is an OpenMP task; all tasks of all 
+// pairs are created in a single parallel region. The earliest hit of a pair is kept in a shared int with a 
+// lock-free minimum, and bands that start after it are skipped, so the result stays deterministic. 
+// Returns false, with 'out' untouched, if memory runs out.
+bool find_pair_matches(const Picture* pics,const ObjectT* objs,int M,const long long* pairs,long long count,double threshold,MatchResult* out){
+    int* bestLin = (int*)malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    if (!bestLin) return false;
+    for (long long t = 0; t < count; ++t) bestLin[t] = INT_MAX;
+    // Value summary of the current picture for the pair prefilter; pairs come picture by picture
+    PictureValues pv = { NULL, 0 };
+    int pvPicture = -1;
+
+    #pragma omp parallel
+    {
+        #pragma omp single nowait
+        {
+            for (long long t = 0; t < count; ++t) {
+                const int pic = (int)(pairs[t] / M);
+                const Picture* P = &pics[pic];
+                const ObjectT* O = &objs[pairs[t] % M];
+                const int N = P->N, n = O->n;
+                if (n > N) continue;
+                if (pic != pvPicture) {
+                    free(pv.v);
+                    build_picture_values(P, objs, M, &pv);
+                    pvPicture = pic;
+                }
+                if (pair_hopeless(&pv, O, threshold)) continue;
+                const int maxI = N - n, maxJ = N - n, W = maxJ + 1;
+                // Aim for roughly 64K pixel comparisons per task
+                long long rowWork = (long long)W * n * n;
+                int band = (int)(65536 / (rowWork > 0 ? rowWork : 1));
+                if (band < 1) band = 1;
+                for (int i0 = 0; i0 <= maxI; i0 += band) {
+                    const int i1 = i0 + band - 1 < maxI ? i0 + band - 1 : maxI;
+                    bool any = false;
+                    for (int i = i0; i <= i1 && !any; ++i) any = roi_row_active(P, i);
+                    if (!any) continue;
+                    #pragma omp task firstprivate(t, i0, i1) shared(bestLin, threshold)
+                    {
+                        bool hit = false;
+                        for (int i = i0; i <= i1 && !hit; ++i) {
+                            if (i * W >= __atomic_load_n(&bestLin[t], __ATOMIC_RELAXED)) break;
+                            int full[2];
+                            const int* sp;
+                            const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                            for (int e = 0; e < ns && !hit; ++e) {
+                                const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                                for (int j = sp[2 * e]; j <= j1; ++j) {
+                                    if (match_position_bounded(P, O, i, j, threshold) < threshold) {
+                                        atomic_min_int(&bestLin[t], i * W + j);
+                                        hit = true; // rest of the band comes later in row-major order
+                                        break;
+                                    }
+                                }
+                            }
+                        }
+                    } // task
+                }
+            }
+        } // single
+        #pragma omp taskwait
+    } // parallel
+    free(pv.v);
+
+    for (long long t = 0; t < count; ++t) {
+        const Picture* P = &pics[pairs[t] / M];
+        const ObjectT* O = &objs[pairs[t] % M];
+        out[t].pictureId = P->id;
+        out[t].objectId  = O->id;
+        out[t].found     = bestLin[t] != INT_MAX;
+        out[t].posI      = -1;
+        out[t].posJ      = -1;
+        out[t].score     = 0.0;
+        out[t].orientation = 0;
+        if (out[t].found) {
+            const int W = P->N - O->n + 1;
+            out[t].posI  = bestLin[t] / W;
+            out[t].posJ  = bestLin[t] % W;
+            out[t].score = match_position(P, O, out[t].posI, out[t].posJ);
+        }
+    }
+    free(bestLin);
+    return true;
+}
+
+// Marker for a masked pixel in SymObject.a
+#define SYM_MASKED INT_MIN
+
+// Source pixel of orientation 'u' at (r,c): the transformed object T satisfies T[r][c] = O[src(r,c)]. 
+// Codes 1-3 rotate clockwise by 90/180/270 degrees, 4 mirrors left-right, 5 transposes, 6 mirrors 
+// top-bottom and 7 mirrors along the anti-diagonal.
+static inline int orient_src(int u,int n,int r,int c){
+ switch(u){
+    case 1: return (n-1-c)*n+r;
+    case 2: return (n-1-r)*n+(n-1-c);
+    case 3: return c*n+(n-1-r);
+    case 4: return r*n+(n-1-c);
+    case 5: return c*n+r;
+    case 6: return (n-1-r)*n+c;
+    case 7: return (n-1-c)*n+(n-1-r);
+    default: return r*n+c;
+}
+}
+
+// Marks the masked pixels of orientation 'u' of a masked object with SYM_MASKED so that the symmetric 
+// kernel skips them (and transforms that differ only in masked pixels are not merged by mistake). 
+// Returns false if memory runs out; the masked pixels would then be scored as zeros, so the caller fails.
+static bool apply_sym_mask(const ObjectT* O,int u,int* dst){
+ const int n=O->n;
+ unsigned char* active=(unsigned char*)calloc((size_t)n*n,1);
+ if(!active) 
+ return false;
+ for(int r=0;r<n;++r) 
+  for(int t=O->maskRow[r];t<O->maskRow[r+1];++t) 
+  active[r*n+O->maskCol[t]]=1;
+ for(int r=0;r<n;++r) 
+  for(int c=0;c<n;++c) 
+  if(!active[orient_src(u,n,r,c)]) dst[r*n+c]=SYM_MASKED;
+ free(active);
+ return true;
+}
+
+// This function prepares the objects for the rotation/flip-invariant search. For every object it builds 
+// the 8 dihedral transforms and keeps only the distinct ones (a symmetric object such as a constant block 
+// keeps just one, a mirror-symmetric one keeps four), always keeping the identity first. The surviving 
+// transforms are stored interleaved, a[(r*n+c)*count+u], so the kernel reads all orientations of one 
+// pixel from consecutive memory. Returns NULL if memory runs out; free with free_symmetric_objects.
+SymObject* prepare_symmetric_objects(const ObjectT* objs,int M){
+ SymObject* out=(SymObject*)calloc((size_t)M+1,sizeof(SymObject));
+ if(!out) 
+ return NULL;
+ for(int k=0;k<M;++k){
+    const int n=objs[k].n, nn=n*n;
+    int* t=(int*)malloc((size_t)8*nn*sizeof(int));
+    out[k].a=(int*)malloc((size_t)8*nn*sizeof(int));
+    if(!t||!out[k].a){
+        free(t);
+        free_symmetric_objects(out,M);
+        return NULL;
+    }
+    out[k].id=objs[k].id;
+    out[k].n=n;
+    int cnt=0;
+    for(int u=0;u<8;++u){
+        int* dst=t+(size_t)cnt*nn;
+        for(int r=0;r<n;++r) 
+         for(int c=0;c<n;++c) 
+         dst[r*n+c]=objs[k].a[orient_src(u,n,r,c)];
+        if(objs[k].maskRow && !apply_sym_mask(&objs[k],u,dst)){
+            free(t);
+            free_symmetric_objects(out,M);
+            return NULL;
+        }
+        bool dup=false;
+        for(int v=0;v<cnt && !dup;++v) 
+        dup=memcmp(t+(size_t)v*nn,dst,(size_t)nn*sizeof(int))==0;
+        if(!dup) 
+        out[k].orient[cnt++]=u;
+    }
+    out[k].count=cnt;
+    for(int px=0;px<nn;++px) 
+     for(int u=0;u<cnt;++u) 
+     out[k].a[px*cnt+u]=t[(size_t)u*nn+px];
+    free(t);
+}
+ return out;
+}
+
+void free_symmetric_objects(SymObject* objs,int M){
+ if(!objs) 
+ return;
+ for(int k=0;k<M;++k) 
+ free(objs[k].a);
+ free(objs);
+}
+
+// Scores all orientations of a symmetric object at window (i,j) in one pass over the window: every 
+// picture pixel is loaded once and compared with the matching pixel of each orientation. Stops after a 
+// row once every orientation is already at or above the threshold. Returns the index (into O->orient) 
+// of the first orientation below the threshold, or -1, and stores its score.
+static inline int match_position_sym(const Picture* P,const SymObject* O,int i,int j,double threshold,double* score){
+ const int N=P->N, n=O->n, cnt=O->count;
+ const int* p=P->a;
+ double sum[8]={0,0,0,0,0,0,0,0};
+ for(int r=0;r<n;++r){
+    const int* prow=p+(size_t)(i+r)*N+j;
+    const int* orow=O->a+(size_t)r*n*cnt;
+    for(int c=0;c<n;++c){
+        const int pv=prow[c];
+        const int* ov=orow+c*cnt;
+        for(int u=0;u<cnt;++u) 
+        if(ov[u]!=SYM_MASKED) sum[u]+=fabs((double)(pv-ov[u])/(double)pv);
+    }
+    bool alive=false;
+    for(int u=0;u<cnt;++u) 
+    alive|=sum[u]<threshold;
+    if(!alive) 
+    return -1;
+}
+ for(int u=0;u<cnt;++u){
+    if(sum[u]<threshold){
+        *score=sum[u];
+        return u;
+    }
+}
+ return -1;
+}
+
+// This function is the rotation/flip-invariant version of find_match_for_picture. It has the same 
+// structure (objects in order, one OpenMP task per candidate row, a shared atomic flag for the early 
+// stop), but every window is scored against all distinct orientations of the object at once with 
+// match_position_sym, so the picture pixels are loaded once instead of once per transformed copy. 
+// On a match 'out' also gets the orientation code that matched.
+bool find_match_for_picture_sym(const Picture* P,const SymObject* objs,int M,double threshold,MatchResult* out){
+    out->pictureId = P->id;
+    out->found     = 0;
+    out->objectId  = -1;
+    out->posI      = -1;
+    out->posJ      = -1;
+    out->score     = 0.0;
+    out->orientation = 0;
+
+    const int N = P->N;
+
+    for (int k = 0; k < M; ++k) {
+        const SymObject* O = &objs[k];
+        const int n = O->n;
+        if (n > N) continue;
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+
+        int foundFlag = 0;   // shared among tasks for this object
+        int winI = -1, winJ = -1, winU = 0;
+        double winScore = 0.0;
+
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i) shared(foundFlag, winI, winJ, winU, winScore, P, O, threshold, maxJ)
+                    {
+                        int full[2];
+                        const int* sp;
+                        const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                        for (int s = 0; s < ns && !__atomic_load_n(&foundFlag, __ATOMIC_RELAXED); ++s) {
+                            const int j1 = sp[2 * s + 1] < maxJ ? sp[2 * s + 1] : maxJ;
+                            for (int j = sp[2 * s]; j <= j1; ++j) {
+                                if (__atomic_load_n(&foundFlag, __ATOMIC_RELAXED)) break;
+                                double sum;
+                                int u = match_position_sym(P, O, i, j, threshold, &sum);
+                                if (u >= 0) {
+                                    int expected = 0;
+                                    if (__atomic_compare_exchange_n(&foundFlag, &expected, 1, 0,
+                                                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                                        winI = i;
+                                        winJ = j;
+                                        winU = O->orient[u];
+                                        winScore = sum;
+                                    }
+                                    break;
+                                }
+                            }
+                        }
+                    } // task
+                }     // for i
+            } // single
+            #pragma omp taskwait
+        } // parallel
+
+        if (foundFlag) {
+            out->found       = 1;
+            out->objectId    = O->id;
+            out->posI        = winI;
+            out->posJ        = winJ;
+            out->score       = winScore;
+            out->orientation = winU;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Flags of a grid point of the strided searches: scored by the coarse pass, and scored below the coarse limit.
+#define GRID_SCORED 2
+#define GRID_PROMISING 1
+
+// Pass 1 of the strided searches: scores the coarse grid (every 'stride'-th row and column inside the ROI) 
+// of one object, cut off at coarseLimit, and sets the GRID_* flags of every grid point it scores. Each task 
+// owns one grid row of 'grid', which the caller has zeroed.
+static void strided_grid(const Picture* P,const ObjectT* O,int maxI,int maxJ,int stride,double coarseLimit,unsigned char* grid,int GW){
+    #pragma omp parallel
+    {
+        #pragma omp single nowait
+        {
+            for (int gi = 0; gi <= maxI; gi += stride) {
+                if (!roi_row_active(P, gi)) continue;
+                #pragma omp task firstprivate(gi) shared(grid, P, O, maxJ, GW, coarseLimit, stride)
+                {
+                    unsigned char* flags = grid + (size_t)(gi / stride) * GW;
+                    int full[2];
+                    const int* sp;
+                    const int ns = roi_row_spans(P, gi, maxJ, full, &sp);
+                    for (int e = 0; e < ns; ++e) {
+                        const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                        for (int gj = (sp[2 * e] + stride - 1) / stride * stride; gj <= j1; gj += stride)
+                            flags[gj / stride] = GRID_SCORED | (match_position_bounded(P, O, gi, gj, coarseLimit) < coarseLimit ? GRID_PROMISING : 0);
+                    }
+                } // task
+            }
+        } // single
+        #pragma omp taskwait
+    } // parallel
+}
+
+// ORs the (at most two) grid rows within stride-1 of row i into near[0..GW). Returns false if the row has 
+// nothing to refine: no promising grid point nearby and no ROI that could leave windows uncovered.
+static bool strided_near(const Picture* P,const unsigned char* grid,int GH,int GW,int stride,int i,unsigned char* near){
+    memset(near, 0, (size_t)GW);
+    bool any = P->roiRow != NULL;
+    const int grHi = (i + stride - 1) / stride < GH - 1 ? (i + stride - 1) / stride : GH - 1;
+    for (int gr = i / stride; gr <= grHi; ++gr) {
+        const unsigned char* flags = grid + (size_t)gr * GW;
+        for (int gc = 0; gc < GW; ++gc) { near[gc] |= flags[gc]; any |= (flags[gc] & GRID_PROMISING) != 0; }
+    }
+    return any;
+}
+
+// True when window (i,j) of a row with 'near' must be scored exactly: a grid column within stride-1 of j is 
+// promising, or none of them was scored at all. The latter only happens with an ROI whose spans or row 
+// ranges fall between the grid lines, and those windows are scanned exhaustively instead of being missed.
+static inline bool strided_refines(const unsigned char* near,int GW,int stride,int j){
+    const int lo = j / stride, hi = (j + stride - 1) / stride;
+    const int f = near[lo] | (hi < GW ? near[hi] : 0);
+    return (f & GRID_PROMISING) || !(f & GRID_SCORED);
+}
+
+// This function is an approximate, faster version of find_all_matches_for_picture for large pictures. 
+// Per object it first scores only a coarse grid (every 'stride'-th row and column, inside the ROI if there 
+// is one), cut off at factor*threshold. Grid points scoring below factor*threshold are "promising": every 
+// window within stride-1 rows and columns of a promising point is then scored exactly, and the ones below 
+// the threshold are reported. Windows with no grid point of the ROI nearby (ROI spans narrower than the 
+// stride, or between two grid rows) are scored exactly as well. Reported hits are exact, but windows with 
+// no promising grid point nearby are missed, so 'out' is a subset of the exhaustive result; a larger factor 
+// trades speed for recall. stride <= 1 is the exhaustive search. Returns the number of hits or -1 on 
+// allocation failure.
+int find_all_matches_strided(const Picture* P,const ObjectT* objs,int M,double threshold,int stride,double factor,MatchList* out){
+    if (stride <= 1) return find_all_matches_for_picture(P, objs, M, threshold, out);
+    out->pictureId = P->id;
+    out->count     = 0;
+
+    const int N = P->N;
+    const double coarseLimit = threshold * factor;
+    const int nthreads = omp_get_max_threads();
+    const int G = (N + stride - 1) / stride + 1;
+    HitBuf* bufs = (HitBuf*)calloc((size_t)nthreads, sizeof(HitBuf));
+    unsigned char* grid = (unsigned char*)malloc((size_t)G * G);
+    // One 'near' row per thread; a task runs start to end on one thread
+    unsigned char* nears = (unsigned char*)malloc((size_t)nthreads * G);
+    if (!bufs || !grid || !nears) { free(bufs); free(grid); free(nears); return -1; }
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+    bool ok = true;
+
+    for (int k = 0; k < M && ok; ++k) {
+        const ObjectT* O = &objs[k];
+        const int n = O->n;
+        if (n > N) continue;
+        if (pair_hopeless(&pv, O, threshold)) continue;
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+        const int GH = maxI / stride + 1, GW = maxJ / stride + 1;
+        memset(grid, 0, (size_t)GH * GW);
+        strided_grid(P, O, maxI, maxJ, stride, coarseLimit, grid, GW);
+
+        // Pass 2: exact scores for the windows strided_refines picks
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    #pragma omp task firstprivate(i) shared(bufs, grid, nears, P, O, threshold, maxJ, GH, GW, G, stride)
+                    {
+                        const int tid = omp_get_thread_num();
+                        HitBuf* b = &bufs[tid];
+                        unsigned char* near = nears + (size_t)tid * G;
+                        int full[2];
+                        const int* sp;
+                        const int ns = strided_near(P, grid, GH, GW, stride, i, near) ? roi_row_spans(P, i, maxJ, full, &sp) : 0;
+                        for (int e = 0; e < ns; ++e) {
+                            const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                            for (int j = sp[2 * e]; j <= j1; ++j)
+                                if (strided_refines(near, GW, stride, j) && match_position_bounded(P, O, i, j, threshold) < threshold)
+                                    hitbuf_push(b, O->id, i, j);
+                        }
+                    } // task
+                }
+            } // single
+            #pragma omp taskwait
+        } // parallel
+
+        for (int t = 0; t < nthreads; ++t)
+            if (bufs[t].failed) ok = false;
+        if (ok) ok = merge_hit_buffers(bufs, nthreads, maxI, out);
+    }
+
+    for (int t = 0; t < nthreads; ++t) free(bufs[t].a);
+    free(bufs);
+    free(grid);
+    free(nears);
+    free(pv.v);
+    return ok ? out->count : -1;
+}
+
+// This function is the first-match version of find_all_matches_strided: the same coarse grid and 
+// refinement, but it stops at the first object with a refined hit, the way find_match_for_picture stops at 
+// its first match. Within that object the answer is the refined hit that comes first in (i,j) order, kept 
+// as a shared linear index that only decreases, so row tasks below it give up early and the result is 
+// the first hit find_all_matches_strided would list. Returns 1 with 'out' filled if a match is found, 0 if 
+// not and -1 on allocation failure.
+int find_match_strided(const Picture* P,const ObjectT* objs,int M,double threshold,int stride,double factor,MatchResult* out){
+    out->pictureId   = P->id;
+    out->found       = 0;
+    out->objectId    = -1;
+    out->posI        = -1;
+    out->posJ        = -1;
+    out->score       = 0.0;
+    out->orientation = 0;
+    if (stride <= 1) return find_match_for_picture(P, objs, M, threshold, out) ? 1 : 0;
+
+    const int N = P->N;
+    const double coarseLimit = threshold * factor;
+    const int nthreads = omp_get_max_threads();
+    const int G = (N + stride - 1) / stride + 1;
+    unsigned char* grid = (unsigned char*)malloc((size_t)G * G);
+    unsigned char* nears = (unsigned char*)malloc((size_t)nthreads * G);
+    if (!grid || !nears) { free(grid); free(nears); return -1; }
+    PictureValues pv;
+    build_picture_values(P, objs, M, &pv);
+
+    for (int k = 0; k < M && !out->found; ++k) {
+        const ObjectT* O = &objs[k];
+        const int n = O->n;
+        if (n > N) continue;
+        if (pair_hopeless(&pv, O, threshold)) continue;
+
+        const int maxI = N - n;
+        const int maxJ = N - n;
+        const int W = maxJ + 1;
+        const int GH = maxI / stride + 1, GW = maxJ / stride + 1;
+        memset(grid, 0, (size_t)GH * GW);
+        strided_grid(P, O, maxI, maxJ, stride, coarseLimit, grid, GW);
+
+        int bestLin = INT_MAX;
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                for (int i = 0; i <= maxI; ++i) {
+                    if (!roi_row_active(P, i)) continue;
+                    if (i * W >= __atomic_load_n(&bestLin, __ATOMIC_RELAXED)) break;
+                    #pragma omp task firstprivate(i) shared(bestLin, grid, nears, P, O, threshold, maxJ, W, GH, GW, G, stride)
+                    {
+                        unsigned char* near = nears + (size_t)omp_get_thread_num() * G;
+                        int full[2];
+                        const int* sp;
+                        const int ns = i * W < __atomic_load_n(&bestLin, __ATOMIC_RELAXED) && strided_near(P, grid, GH, GW, stride, i, near)
+                                     ? roi_row_spans(P, i, maxJ, full, &sp) : 0;
+                        bool hit = false;
+                        for (int e = 0; e < ns && !hit; ++e) {
+                            const int j1 = sp[2 * e + 1] < maxJ ? sp[2 * e + 1] : maxJ;
+                            for (int j = sp[2 * e]; j <= j1; ++j) {
+                                // An earlier window already matched
+                                if (i * W + j >= __atomic_load_n(&bestLin, __ATOMIC_RELAXED)) { hit = true; break; }
+                                if (strided_refines(near, GW, stride, j) && match_position_bounded(P, O, i, j, threshold) < threshold) {
+                                    atomic_min_int(&bestLin, i * W + j);
+                                    hit = true;
+                                    break;
+                                }
+                            }
+                        }
+                    } // task
+                }
+            } // single
+            #pragma omp taskwait
+        } // parallel
+
+        if (bestLin != INT_MAX) {
+            out->found    = 1;
+            out->objectId = O->id;
+            out->posI     = bestLin / W;
+            out->posJ     = bestLin % W;
+            out->score    = match_position(P, O, out->posI, out->posJ);
+        }
+    }
+
+    free(grid);
+    free(nears);
+    free(pv.v);
+    return out->found;
+}
+
+// Small deterministic generator for the pixel samples (xorshift64*), so every rank builds the same sample.
+static inline unsigned long long sample_rand(unsigned long long* x){
+ *x^=*x>>12;
+ *x^=*x<<25;
+ *x^=*x>>27;
+ return *x*2685821657736338717ULL;
+}
+
+// This function attaches a SamplePlan to every object with more than 'count' active pixels: 'count' 
+// pixels chosen uniformly at random (partial Fisher-Yates with a fixed seed per object) and sorted by 
+// position so the gathers walk the window top to bottom. For the exact variant restSum holds the sum of 
+// the object pixels outside the sample; it is -1 for masked objects, where the window sum of the 
+// summed-area table would include masked pixels and the unseen-pixel bound does not hold. Objects with 
+// fewer pixels than 'count' are scored exactly as before. Returns false if memory runs out.
+bool prepare_sample_plans(ObjectT* objs,int M,int count,bool probabilistic,double z,unsigned long long seed){
+ for(int k=0;k<M;++k){
+    ObjectT* O=&objs[k];
+    const int n=O->n;
+    const int total=O->maskRow?O->maskRow[n]:n*n;
+    O->sample=NULL;
+    if(count<1 || count>=total) 
+    continue;
+    int* idx=(int*)malloc((size_t)total*sizeof(int));
+    SamplePlan* plan=(SamplePlan*)calloc(1,sizeof(SamplePlan));
+    if(plan){
+        plan->r=(int*)malloc((size_t)count*sizeof(int));
+        plan->c=(int*)malloc((size_t)count*sizeof(int));
+        plan->v=(int*)malloc((size_t)count*sizeof(int));
+    }
+    if(!idx||!plan||!plan->r||!plan->c||!plan->v){
+        free(idx);
+        if(plan){ free(plan->r); free(plan->c); free(plan->v); free(plan); }
+        return false;
+    }
+    for(int t=0;t<total;++t) 
+    idx[t]=t;
+    unsigned long long x=seed^(0x9E3779B97F4A7C15ULL*(unsigned long long)(k+1));
+    if(!x) x=1;
+    for(int t=0;t<count;++t){
+        int u=t+(int)(sample_rand(&x)%(unsigned long long)(total-t));
+        int tmp=idx[t]; idx[t]=idx[u]; idx[u]=tmp;
+    }
+    qsort(idx,(size_t)count,sizeof(int),cmp_int);
+    long long sampled=0, all=0;
+    for(int t=0;t<count;++t){
+        // idx counts active pixels; for masked objects map it through the compacted lists
+        int r,c,v;
+        if(O->maskRow){
+            r=0;
+            while(O->maskRow[r+1]<=idx[t]) ++r;
+            c=O->maskCol[idx[t]];
+            v=O->maskVal[idx[t]];
+        } else {
+            r=idx[t]/n;
+            c=idx[t]%n;
+            v=O->a[idx[t]];
+        }
+        plan->r[t]=r;
+        plan->c[t]=c;
+        plan->v[t]=v;
+        sampled+=v;
+    }
+    for(int t=0;t<n*n;++t) 
+    all+=O->a[t];
+    plan->count=count;
+    plan->total=total;
+    plan->probabilistic=probabilistic;
+    plan->z=z;
+    plan->restSum=O->maskRow?-1:all-sampled;
+    O->sample=plan;
+    free(idx);
+}
+ return true;
+}
+
+void free_sample_plans(ObjectT* objs,int M){
+ for(int k=0;k<M;++k){
+    SamplePlan* plan=objs[k].sample;
+    if(!plan) 
+    continue;
+    free(plan->r);
+    free(plan->c);
+    free(plan->v);
+    free(plan);
+    objs[k].sample=NULL;
+}
+}
+
+// This function attaches a ValueSummary to every object: the distinct values of its active pixels (all
+// pixels when unmasked) with their counts, used by the pair prefilter. Returns false if memory runs out.
+bool prepare_value_summaries(ObjectT* objs,int M){
+ for(int k=0;k<M;++k){
+    ObjectT* O=&objs[k];
+    const int total=O->maskRow?O->maskRow[O->n]:O->n*O->n;
+    ValueSummary* s=(ValueSummary*)calloc(1,sizeof(ValueSummary));
+    int* v=(int*)malloc(((size_t)total+1)*sizeof(int));
+    int* c=(int*)malloc(((size_t)total+1)*sizeof(int));
+    if(!s||!v||!c){
+        free(s);
+        free(v);
+        free(c);
+        return false;
+    }
+    memcpy(v,O->maskRow?O->maskVal:O->a,(size_t)total*sizeof(int));
+    qsort(v,(size_t)total,sizeof(int),cmp_int);
+    int u=0;
+    for(int t=0;t<total;++t){
+        if(u>0 && v[t]==v[u-1]){
+            c[u-1]++;
+            continue;
+        }
+        v[u]=v[t];
+        c[u++]=1;
+    }
+    s->count=u;
+    s->v=v;
+    s->c=c;
+    O->values=s;
+}
+ return true;
+}
+
+void free_value_summaries(ObjectT* objs,int M){
+ for(int k=0;k<M;++k){
+    if(!objs[k].values) 
+    continue;
+    free(objs[k].values->v);
+    free(objs[k].values->c);
+    free(objs[k].values);
+    objs[k].values=NULL;
+}
+}
+
+// This function groups the unmasked objects into clusters for the similarity pruning. Objects are visited in
+// input order; each joins the nearest existing medoid of its size when the mean absolute pixel difference
+// to it is at most 'radius', and otherwise becomes a medoid itself. Medoids that end up without members get
+// no cluster record, so only real clusters cost a plane at search time. Returns false if memory runs out.
+bool prepare_object_clusters(ObjectT* objs,int M,double radius){
+ int* leaders=(int*)malloc(((size_t)M+1)*sizeof(int));
+ if(!leaders) 
+ return false;
+ int L=0;
+ bool ok=true;
+ for(int k=0;k<M && ok;++k){
+    ObjectT* O=&objs[k];
+    if(O->maskRow) 
+    continue;
+    const size_t nn=(size_t)O->n*O->n;
+    const long long limit=(long long)(radius*(double)nn);
+    int best=-1;
+    long long bestDist=LLONG_MAX;
+    for(int x=0;x<L;++x){
+        const ObjectT* A=&objs[leaders[x]];
+        if(A->n!=O->n) 
+        continue;
+        long long d=0;
+        for(size_t t=0;t<nn && d<bestDist && d<=limit;++t) 
+        d+=llabs((long long)A->a[t]-O->a[t]);
+        if(d<bestDist && d<=limit){
+            best=leaders[x];
+            bestDist=d;
+        }
+    }
+    O->cluster=(ObjectCluster*)malloc(sizeof(ObjectCluster));
+    if(!O->cluster){
+        ok=false;
+        break;
+    }
+    O->cluster->lastMember=-1;
+    if(best<0){
+        O->cluster->leader=-1;
+        O->cluster->dist=0;
+        leaders[L++]=k;
+    } else {
+        O->cluster->leader=best;
+        O->cluster->dist=bestDist;
+        objs[best].cluster->lastMember=k;
+    }
+}
+ free(leaders);
+ for(int k=0;k<M;++k){
+    if(objs[k].cluster && objs[k].cluster->leader<0 && objs[k].cluster->lastMember<0){
+        free(objs[k].cluster);
+        objs[k].cluster=NULL;
+    }
+}
+ if(!ok) 
+ free_object_clusters(objs,M);
+ return ok;
+}
+
+void free_object_clusters(ObjectT* objs,int M){
+ for(int k=0;k<M;++k){
+    free(objs[k].cluster);
+    objs[k].cluster=NULL;
+}
+}
+
+// Prefix-sharing search. Libraries built from templates hold many objects whose first rows are identical,
+// and the per-object engines recompute the same partial sums for each of them. The object trie merges those
+// rows: the search walks it once per window, extends the partial sum of a node by the score of each child's
+// row and descends, so a shared row is scored once per window however many objects share it. Partial sums
+// only grow, so a node whose sum already reaches the threshold cuts off its whole subtree. Every row sum is
+// accumulated pixel by pixel in the same order as match_position, so the scores are bit-identical to the
+// per-object engines.
+
+static long long g_trieRows=0;
+static long long g_trieCut=0;
+
+static void count_trie(long long rows,long long cut){
+ if(rows) 
+ __atomic_fetch_add(&g_trieRows,rows,__ATOMIC_RELAXED);
+ if(cut) 
+ __atomic_fetch_add(&g_trieCut,cut,__ATOMIC_RELAXED);
+}
+
+// Process-wide counters of the prefix-sharing search: trie rows scored against a window, and subtrees
+// cut off because their prefix already reached the threshold.
+void trie_search_stats(long long* rows,long long* cut){
+ *rows=__atomic_load_n(&g_trieRows,__ATOMIC_RELAXED);
+ *cut=__atomic_load_n(&g_trieCut,__ATOMIC_RELAXED);
+}
+
+// Answer of the first-match walk, shared by all tasks: the smallest matching object index so far and its
+// window. k only decreases; it is written under a critical section and read without a lock.
+typedef struct{
+    int k;
+    int i;
+    int j;
+    double score;
+} 
+TrieFirst;
+
+static void trie_first_hit(TrieFirst* f,int k,int i,int j,double score){
+ #pragma omp critical(pds_trie_first)
+ {
+    if(k<f->k){
+        f->i=i;
+        f->j=j;
+        f->score=score;
+        __atomic_store_n(&f->k,k,__ATOMIC_RELAXED);
+    }
+}
+}
+
+// Walk state of one task: the window being scored, where its answers go (first-match record or the
+// thread's hit buffer) and the task's work counters.
+typedef struct{
+    const Picture* P;
+    const TrieGroup* g;
+    const int* next;
+    int i;
+    int j;
+    double threshold;
+    TrieFirst* first;
+    HitBuf* b;
+    long long rows;
+    long long cut;
+} 
+TrieWalk;
+
+// Scores the sibling list starting at node x (depth d) against the current window, on top of the parent's
+// partial sum, and descends into every child whose sum is still below the threshold. A complete path is a
+// match of every object ending in the leaf.
+static void trie_walk(TrieWalk* w,int x,int d,double partial){
+ const int n=w->g->n;
+ const int* prow=w->P->a+(size_t)(w->i+d)*w->P->N+w->j;
+ for(;x>=0;x=w->g->nodes[x].sibling){
+    const TrieNode* t=&w->g->nodes[x];
+    // Siblings come in ascending minObj order, so none of the rest can improve the first match either
+    if(w->first && t->minObj>=__atomic_load_n(&w->first->k,__ATOMIC_RELAXED)) 
+    break;
+    double sum=partial;
+    for(int c=0;c<n;++c){
+        int pv=prow[c], ov=t->row[c]; 
+        sum+=fabs((double)(pv-ov)/(double)pv);
+    }
+    w->rows++;
+    if(sum>=w->threshold){
+        w->cut++;
+        continue;
+    }
+    if(t->child>=0) 
+    trie_walk(w,t->child,d+1,sum);
+    else if(w->first) 
+    trie_first_hit(w->first,t->leaf,w->i,w->j,sum);
+    else for(int k=t->leaf;k>=0;k=w->next[k]) 
+    hitbuf_push(w->b,k,w->i,w->j);
+}
+}
+
+// This function scores every window of one trie group, one OpenMP task per candidate row like the other
+// engines. A masked group is a single object scored with match_position. With 'first' set, a window is
+// skipped as soon as nothing in the group can beat the smallest matching object found so far; otherwise
+// every hit goes to the thread's buffer in 'bufs' with the object index as its objectId.
+static void trie_group_search(const Picture* P,const ObjectTrie* t,const TrieGroup* g,const ObjectT* objs,double threshold,TrieFirst* first,HitBuf* bufs){
+    const int n = g->n;
+    const int maxI = P->N - n;
+    const int maxJ = P->N - n;
+
+    #pragma omp parallel
+    {
+        #pragma omp single nowait
+        {
+            for (int i = 0; i <= maxI; ++i) {
+                if (!roi_row_active(P, i)) continue;
+                #pragma omp task firstprivate(i) shared(P, t, g, objs, threshold, first, bufs, maxJ)
+                {
+                    TrieWalk w = { P, g, t->next, i, 0, threshold, first, bufs ? &bufs[omp_get_thread_num()] : NULL, 0, 0 };
+                    int full[2];
+                    const int* sp;
+                    const int ns = roi_row_spans(P, i, maxJ, full, &sp);
+                    for (int s = 0; s < ns; ++s) {
+                        const int j1 = sp[2 * s + 1] < maxJ ? sp[2 * s + 1] : maxJ;
+                        for (int j = sp[2 * s]; j <= j1; ++j) {
+                            if (first && g->minObj >= __atomic_load_n(&first->k, __ATOMIC_RELAXED)) break;
+                            w.j = j;
+                            if (g->masked < 0) { trie_walk(&w, g->root, 0, 0.0); continue; }
+                            const double sum = match_position(P, &objs[g->masked], i, j);
+                            if (sum >= threshold) continue;
+                            if (first) trie_first_hit(first, g->masked, i, j, sum);
+                            else hitbuf_push(w.b, g->masked, i, j);
+                        }
+                    }
+                    count_trie(w.rows, w.cut);
+                } // task
+            }     // for i
+        } // single
+        #pragma omp taskwait
+    } // parallel
+}
+
+// This function is the prefix-sharing variant of find_match_for_picture. It reports the same object (the
+// first one in input order that matches anywhere): the groups are searched in order of their smallest
+// object, and every walk stops at nodes whose objects all come after the best match found so far. As in the
+// per-object search, the reported window of that object is whichever matching window was found first.
+bool find_match_trie(const Picture* P,const ObjectTrie* t,const ObjectT* objs,double threshold,MatchResult* out){
+    out->pictureId = P->id;
+    out->found     = 0;
+    out->objectId  = -1;
+    out->posI      = -1;
+    out->posJ      = -1;
+    out->score     = 0.0;
+    out->orientation = 0;
+
+    TrieFirst first = { INT_MAX, -1, -1, 0.0 };
+    for (int x = 0; x < t->groups; ++x) {
+        const TrieGroup* g = &t->g[x];
+        if (g->n > P->N || g->minObj >= first.k) continue;
+        trie_group_search(P, t, g, objs, threshold, &first, NULL);
+    }
+    if (first.k == INT_MAX) return false;
+
+    out->found    = 1;
+    out->objectId = objs[first.k].id;
+    out->posI     = first.i;
+    out->posJ     = first.j;
+    out->score    = first.score;
+    return true;
+}
+
+static int cmp_hit_object(const void* x,const void* y){
+ const MatchHit* a=(const MatchHit*)x;
+ const MatchHit* b=(const MatchHit*)y;
+ if(a->objectId!=b->objectId) 
+ return (a->objectId>b->objectId)-(a->objectId<b->objectId);
+ if(a->posI!=b->posI) 
+ return (a->posI>b->posI)-(a->posI<b->posI);
+ return (a->posJ>b->posJ)-(a->posJ<b->posJ);
+}
+
+// This function is the prefix-sharing variant of find_all_matches_for_picture and returns the same list.
+// The hits of a group carry object indices while they are collected; at the end they are sorted by
+// (object, i, j) and the indices replaced by the object ids. Returns the number of hits or -1 if memory
+// runs out.
+int find_all_matches_trie(const Picture* P,const ObjectTrie* t,const ObjectT* objs,double threshold,MatchList* out){
+    out->pictureId = P->id;
+    out->count     = 0;
+
+    const int nthreads = omp_get_max_threads();
+    HitBuf* bufs = (HitBuf*)calloc((size_t)nthreads, sizeof(HitBuf));
+    if (!bufs) return -1;
+    bool ok = true;
+
+    for (int x = 0; x < t->groups && ok; ++x) {
+        const TrieGroup* g = &t->g[x];
+        if (g->n > P->N) continue;
+        trie_group_search(P, t, g, objs, threshold, NULL, bufs);
+        for (int b = 0; b < nthreads; ++b)
+            if (bufs[b].failed) ok = false;
+        if (ok) ok = merge_hit_buffers(bufs, nthreads, P->N - g->n, out);
+    }
+
+    for (int b = 0; b < nthreads; ++b) free(bufs[b].a);
+    free(bufs);
+    if (!ok) return -1;
+    if (out->count > 1) qsort(out->hits, (size_t)out->count, sizeof(MatchHit), cmp_hit_object);
+    for (int h = 0; h < out->count; ++h)
+        out->hits[h].objectId = objs[out->hits[h].objectId].id;
+    return out->count;
+}
+
+static int trie_add_node(TrieGroup* g,const int* row,int k){
+ if(g->count==g->cap){
+    const int cap=g->cap?2*g->cap:64;
+    TrieNode* a=(TrieNode*)realloc(g->nodes,(size_t)cap*sizeof(TrieNode));
+    if(!a) 
+    return -1;
+    g->nodes=a;
+    g->cap=cap;
+}
+ TrieNode* t=&g->nodes[g->count];
+ t->row=row;
+ t->child=-1;
+ t->sibling=-1;
+ t->minObj=k;
+ t->leaf=-1;
+ return g->count++;
+}
+
+// This function builds the object trie of the prefix-sharing search. Unmasked objects are grouped by size
+// (groups in order of their first object) and inserted row by row in input order, so the children of every
+// node are in ascending minObj order and identical objects end in the same leaf, chained in input order.
+// A masked object gets a group of its own. The nodes point into the objects' pixels, so the objects must
+// outlive the trie. Returns NULL if memory runs out.
+ObjectTrie* prepare_object_trie(const ObjectT* objs,int M){
+ ObjectTrie* t=(ObjectTrie*)calloc(1,sizeof(ObjectTrie));
+ if(!t) 
+ return NULL;
+ t->g=(TrieGroup*)calloc((size_t)M+1,sizeof(TrieGroup));
+ t->next=(int*)malloc(((size_t)M+1)*sizeof(int));
+ if(!t->g||!t->next){
+    free_object_trie(t);
+    return NULL;
+}
+ for(int k=0;k<M;++k){
+    const ObjectT* O=&objs[k];
+    const int n=O->n;
+    t->next[k]=-1;
+    TrieGroup* g=NULL;
+    for(int x=0;x<t->groups && !O->maskRow && !g;++x)
+     if(t->g[x].masked<0 && t->g[x].n==n) 
+     g=&t->g[x];
+    if(!g){
+        g=&t->g[t->groups++];
+        g->n=n;
+        g->masked=O->maskRow?k:-1;
+        g->minObj=k;
+        g->root=-1;
+        if(O->maskRow) 
+        continue;
+    }
+    // Follow the rows down the trie, adding a node where no sibling has the same row
+    int parent=-1, x=-1;
+    for(int r=0;r<n;++r){
+        const int* row=O->a+(size_t)r*n;
+        int prev=-1;
+        x=parent<0?g->root:g->nodes[parent].child;
+        while(x>=0 && memcmp(g->nodes[x].row,row,(size_t)n*sizeof(int))!=0){
+            prev=x;
+            x=g->nodes[x].sibling;
+        }
+        if(x<0){
+            x=trie_add_node(g,row,k);
+            if(x<0){
+                free_object_trie(t);
+                return NULL;
+            }
+            if(prev>=0) 
+            g->nodes[prev].sibling=x;
+            else if(parent>=0) 
+            g->nodes[parent].child=x;
+            else g->root=x;
+            t->nodes++;
+        }
+        parent=x;
+    }
+    if(g->nodes[x].leaf<0) 
+    g->nodes[x].leaf=k;
+    else {
+        int e=g->nodes[x].leaf;
+        while(t->next[e]>=0) e=t->next[e];
+        t->next[e]=k;
+    }
+    t->rows+=n;
+}
+ return t;
+}
+
+void free_object_trie(ObjectTrie* t){
+ if(!t) 
+ return;
+ for(int x=0;x<t->groups;++x) 
+ free(t->g[x].nodes);
+ free(t->g);
+ free(t->next);
+ free(t);
+}
+
+// Incremental re-search. An IncrementalState keeps a private copy of a picture together with one value per
+// (object, window): either the exact score or, when the summed-area bound applies, only that lower bound
+// (exact[k][w] says which). A picture update rewrites a rectangle of pixels, patches the summed-area table
+// and refreshes only the windows that overlap the rectangle; every other window keeps its value. Queries
+// turn the bounds that fall below their threshold into exact scores (once; they stay cached), then read the
+// answer off the planes. The planes cost one double and one byte per window and object.
+
+// Recomputes the summed-area table bound (or the exact score where the bound doesn't apply) of the
+// windows of object k with top-left rows i0..i1 and columns j0..j1.
+static void incremental_refresh(IncrementalState* st,const ObjectT* objs,int k,int i0,int i1,int j0,int j1){
+ const Picture* P=&st->pic;
+ const ObjectT* O=&objs[k];
+ const int n=O->n, W=P->N-n+1, S=P->N+1;
+ const bool useLB=st->minv>0 && !O->maskRow;
+ const double invMax=useLB?1.0/(double)st->maxv:0.0;
+ double* v=st->score[k];
+ unsigned char* ex=st->exact[k];
+ long long scored=0;
+ #pragma omp parallel
+ {
+    #pragma omp single nowait
+    {
+        for(int i=i0;i<=i1;++i){
+            #pragma omp task firstprivate(i) shared(v,ex,P,O,scored)
+            {
+                long long local=0;
+                for(int j=j0;j<=j1;++j){
+                    const size_t w=(size_t)i*W+j;
+                    if(useLB){
+                        const long long* s=st->sat;
+                        long long sum=s[(size_t)(i+n)*S+j+n]-s[(size_t)i*S+j+n]-s[(size_t)(i+n)*S+j]+s[(size_t)i*S+j];
+                        v[w]=fabs((double)(sum-st->objSum[k]))*invMax*(1.0-1e-12);
+                        ex[w]=0;
+                    } else {
+                        v[w]=match_position(P,O,i,j);
+                        ex[w]=1;
+                        local++;
+                    }
+                }
+                __atomic_fetch_add(&scored,local,__ATOMIC_RELAXED);
+            } // task
+        }
+    } // single
+ } // parallel
+ st->rescored+=scored;
+ st->refreshed+=(long long)(i1-i0+1)*(j1-j0+1);
+}
+
+static void incremental_minmax(IncrementalState* st){
+ const int NN=st->pic.N*st->pic.N;
+ int lo=st->pic.a[0], hi=lo;
+ for(int t=1;t<NN;++t){
+    if(st->pic.a[t]<lo) lo=st->pic.a[t];
+    if(st->pic.a[t]>hi) hi=st->pic.a[t];
+}
+ st->minv=lo;
+ st->maxv=hi;
+}
+
+// This function starts tracking a picture: it copies the pixels, builds the summed-area table over the
+// whole picture and fills every window of every object with its bound or exact score. ROIs of the picture
+// are ignored. Returns false (with st freed) if memory runs out.
+bool incremental_init(IncrementalState* st,const Picture* pic,const ObjectT* objs,int M){
+ memset(st,0,sizeof *st);
+ const int N=pic->N, S=N+1;
+ st->pic.id=pic->id;
+ st->pic.N=N;
+ st->M=M;
+ st->pic.a=(int*)malloc((size_t)N*N*sizeof(int));
+ st->sat=(long long*)calloc((size_t)S*S,sizeof(long long));
+ st->score=(double**)calloc((size_t)M+1,sizeof(double*));
+ st->exact=(unsigned char**)calloc((size_t)M+1,sizeof(unsigned char*));
+ st->objSum=(long long*)calloc((size_t)M+1,sizeof(long long));
+ bool ok=st->pic.a && st->sat && st->score && st->exact && st->objSum;
+ for(int k=0;k<M && ok;++k){
+    const int n=objs[k].n;
+    if(n>N) 
+    continue;
+    const size_t W=(size_t)(N-n+1);
+    st->score[k]=(double*)malloc(W*W*sizeof(double));
+    st->exact[k]=(unsigned char*)malloc(W*W);
+    ok=st->score[k] && st->exact[k];
+    for(int t=0;t<n*n;++t) 
+    st->objSum[k]+=objs[k].a[t];
+}
+ if(!ok){
+    incremental_free(st);
+    return false;
+}
+ memcpy(st->pic.a,pic->a,(size_t)N*N*sizeof(int));
+ for(int r=0;r<N;++r){
+    long long row=0;
+    for(int c=0;c<N;++c){
+        row+=st->pic.a[(size_t)r*N+c];
+        st->sat[(size_t)(r+1)*S+c+1]=st->sat[(size_t)r*S+c+1]+row;
+    }
+}
+ incremental_minmax(st);
+ for(int k=0;k<M;++k) 
+ if(st->score[k]) 
+ incremental_refresh(st,objs,k,0,N-objs[k].n,0,N-objs[k].n);
+ return true;
+}
+
+// This function applies one dirty rectangle: pixels holds h*w new values for rows r0.. and columns c0..
+// (row-major; parts outside the picture are ignored). The summed-area table is patched by adding the 2D
+// prefix sums of the pixel deltas to the entries below and right of the rectangle, and for every object only
+// the windows whose top-left lies in [r0-n+1, r0+h-1] x [c0-n+1, c0+w-1] are refreshed. Returns false if
+// memory runs out.
+bool incremental_update(IncrementalState* st,const ObjectT* objs,int M,int r0,int c0,int h,int w,const int* pixels){
+ const int N=st->pic.N, S=N+1;
+ const int rs=r0<0?-r0:0, cs=c0<0?-c0:0;
+ const int re=r0+h>N?N-r0:h, ce=c0+w>N?N-c0:w;
+ if(rs>=re || cs>=ce) 
+ return true;
+ const int R0=r0+rs, C0=c0+cs, H=re-rs, Wd=ce-cs;
+ long long* d=(long long*)calloc((size_t)(H+1)*(Wd+1),sizeof(long long));
+ if(!d) 
+ return false;
+ for(int r=0;r<H;++r){
+    long long row=0;
+    for(int c=0;c<Wd;++c){
+        int* px=&st->pic.a[(size_t)(R0+r)*N+C0+c];
+        const int nv=pixels[(size_t)(rs+r)*w+cs+c];
+        row+=(long long)nv-*px;
+        *px=nv;
+        d[(size_t)(r+1)*(Wd+1)+c+1]=d[(size_t)r*(Wd+1)+c+1]+row;
+    }
+}
+ #pragma omp parallel for
+ for(int R=R0+1;R<=N;++R){
+    const int rr=R-R0<H?R-R0:H;
+    for(int C=C0+1;C<=N;++C){
+        const int cc=C-C0<Wd?C-C0:Wd;
+        st->sat[(size_t)R*S+C]+=d[(size_t)rr*(Wd+1)+cc];
+    }
+}
+ free(d);
+ incremental_minmax(st);
+ for(int k=0;k<M;++k){
+    if(!st->score[k]) 
+    continue;
+    const int n=objs[k].n, maxIJ=N-n;
+    const int i0=R0-n+1>0?R0-n+1:0, i1=R0+H-1<maxIJ?R0+H-1:maxIJ;
+    const int j0=C0-n+1>0?C0-n+1:0, j1=C0+Wd-1<maxIJ?C0+Wd-1:maxIJ;
+    if(i0<=i1 && j0<=j1) 
+    incremental_refresh(st,objs,k,i0,i1,j0,j1);
+}
+ return true;
+}
+
+// Makes every window whose cached bound is below the threshold exact, so afterwards a window matches
+// exactly when its value is below the threshold.
+static void incremental_resolve(IncrementalState* st,const ObjectT* objs,int M,double threshold){
+ const Picture* P=&st->pic;
+ long long scored=0;
+ for(int k=0;k<M;++k){
+    if(!st->score[k]) 
+    continue;
+    const ObjectT* O=&objs[k];
+    const int W=P->N-O->n+1;
+    double* v=st->score[k];
+    unsigned char* ex=st->exact[k];
+    #pragma omp parallel for schedule(dynamic) reduction(+:scored)
+    for(int i=0;i<W;++i){
+        for(int j=0;j<W;++j){
+            const size_t w=(size_t)i*W+j;
+            if(ex[w] || v[w]>=threshold) 
+            continue;
+            v[w]=match_position(P,O,i,j);
+            ex[w]=1;
+            scored++;
+        }
+    }
+}
+ st->rescored+=scored;
+}
+
+// This function answers a first-match (the first hit in object, row, column order) or best-match query
+// from the cached planes.
+bool incremental_find(IncrementalState* st,const ObjectT* objs,int M,double threshold,SearchMode mode,MatchResult* out){
+ out->pictureId=st->pic.id;
+ out->found=0;
+ out->objectId=-1;
+ out->posI=-1;
+ out->posJ=-1;
+ out->score=0.0;
+ out->orientation=0;
+ incremental_resolve(st,objs,M,threshold);
+ double best=threshold;
+ for(int k=0;k<M;++k){
+    if(!st->score[k]) 
+    continue;
+    const int W=st->pic.N-objs[k].n+1;
+    const double* v=st->score[k];
+    for(int w=0;w<W*W;++w){
+        if(v[w]>=best) 
+        continue;
+        out->found=1;
+        out->objectId=objs[k].id;
+        out->posI=w/W;
+        out->posJ=w%W;
+        out->score=v[w];
+        if(mode!=SEARCH_BEST) 
+        return true;
+        best=v[w];
+    }
+}
+ return out->found;
+}
+
+// This function lists every matching (object, position) of the tracked picture in (object, i, j) order.
+// Returns the number of hits or -1 if memory runs out.
+int incremental_find_all(IncrementalState* st,const ObjectT* objs,int M,double threshold,MatchList* out){
+ out->pictureId=st->pic.id;
+ out->count=0;
+ incremental_resolve(st,objs,M,threshold);
+ for(int k=0;k<M;++k){
+    if(!st->score[k]) 
+    continue;
+    const int W=st->pic.N-objs[k].n+1;
+    const double* v=st->score[k];
+    for(int w=0;w<W*W;++w){
+        if(v[w]>=threshold) 
+        continue;
+        if(out->count==out->cap){
+            int cap=out->cap?2*out->cap:64;
+            MatchHit* a=(MatchHit*)realloc(out->hits,(size_t)cap*sizeof(MatchHit));
+            if(!a) 
+            return -1;
+            out->hits=a;
+            out->cap=cap;
+        }
+        MatchHit* h=&out->hits[out->count++];
+        h->objectId=objs[k].id;
+        h->posI=w/W;
+        h->posJ=w%W;
+    }
+}
+ return out->count;
+}
+
+void incremental_free(IncrementalState* st){
+ for(int k=0;k<st->M;++k){
+    if(st->score) free(st->score[k]);
+    if(st->exact) free(st->exact[k]);
+}
+ free(st->score);
+ free(st->exact);
+ free(st->objSum);
+ free(st->sat);
+ free(st->pic.a);
+ memset(st,0,sizeof *st);
+}
@@ -2,3 +2,38 @@
 #include <stdbool.h>
 #include "types.h"
 bool find_match_for_picture(const Picture* pic,const ObjectT* objs,int M,double threshold,MatchResult* out);
+bool find_match_near(const Picture* pic,const ObjectT* objs,int M,double threshold,int objectId,int ci,int cj,int radius,MatchResult* out);
+bool find_best_match_for_picture(const Picture* pic,const ObjectT* objs,int M,double threshold,MatchResult* out);
+int find_topk_matches_for_picture(const Picture* pic,const ObjectT* objs,int M,double threshold,int K,ScoredMatch* out);
+bool find_first_matches_multi(const Picture* pic,const ObjectT* objs,int M,const double* thresholds,int T,MatchResult* out);
+bool find_pair_matches(const Picture* pics,const ObjectT* objs,int M,const long long* pairs,long long count,double threshold,MatchResult* out);
+SymObject* prepare_symmetric_objects(const ObjectT* objs,int M);
+void free_symmetric_objects(SymObject* objs,int M);
+bool find_match_for_picture_sym(const Picture* pic,const SymObject* objs,int M,double threshold,MatchResult* out);
+int find_all_matches_for_picture(const Picture* pic,const ObjectT* objs,int M,double threshold,MatchList* out);
+int find_all_matches_strided(const Picture* pic,const ObjectT* objs,int M,double threshold,int stride,double factor,MatchList* out);
+int find_match_strided(const Picture* pic,const ObjectT* objs,int M,double threshold,int stride,double factor,MatchResult* out);
+bool prepare_sample_plans(ObjectT* objs,int M,int count,bool probabilistic,double z,unsigned long long seed);
+void free_sample_plans(ObjectT* objs,int M);
+void match_list_free(MatchList* l);
+long long score_all_windows(const Picture* P,const ObjectT* O,double limit,double* scores);
+void window_repeat_stats(long long* skipped,long long* visited);
+bool prepare_value_summaries(ObjectT* objs,int M);
+void free_value_summaries(ObjectT* objs,int M);
+void pair_filter_stats(long long* skipped,long long* tested);
+bool prepare_object_clusters(ObjectT* objs,int M,double radius);
+void free_object_clusters(ObjectT* objs,int M);
+void cluster_prune_stats(long long* skipped,long long* visited);
+ObjectTrie* prepare_object_trie(const ObjectT* objs,int M);
+void free_object_trie(ObjectTrie* t);
+bool find_match_trie(const Picture* pic,const ObjectTrie* t,const ObjectT* objs,double threshold,MatchResult* out);
+int find_all_matches_trie(const Picture* pic,const ObjectTrie* t,const ObjectT* objs,double threshold,MatchList* out);
+void trie_search_stats(long long* rows,long long* cut);
+#ifdef PDS_COUNTERS
+void hot_counters(HotCounters* total,const HotCounters** objects,int* objectCount,const HotPicture** pictures,int* pictureCount);
+#endif
+bool incremental_init(IncrementalState* st,const Picture* pic,const ObjectT* objs,int M);
+bool incremental_update(IncrementalState* st,const ObjectT* objs,int M,int r0,int c0,int h,int w,const int* pixels);
+bool incremental_find(IncrementalState* st,const ObjectT* objs,int M,double threshold,SearchMode mode,MatchResult* out);
+int incremental_find_all(IncrementalState* st,const ObjectT* objs,int M,double threshold,MatchList* out);
+void incremental_free(IncrementalState* st);
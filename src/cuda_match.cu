@@ -175,6 +175,8 @@ if (kerr != cudaSuccess) {
       out->objectId  = O->id;
       out->posI      = i;
       out->posJ      = j;
+      out->score     = 0.0; // the kernel only reports the position
+      out->orientation = 0;
 
       // Cleanup
       if (d_objA) cudaFree(d_objA);
@@ -0,0 +1,400 @@
+#define _POSIX_C_SOURCE 200809L
+#include "daemon.h"
+#include "compute.h"
+#include "io.h"
+#include <errno.h>
+#include <omp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Daemon mode: the object library is read once and preprocessed into a search context (see pds.h), the
+// OpenMP thread pool is started once, and then picture batches are answered one after another, either on
+// stdin/stdout or over a UNIX domain socket. The protocol is line based text and reuses the input and
+// output file formats:
+//
+//   BATCH <count> [threshold]      followed by <count> pictures exactly as in the input file
+//   -> the result lines of the output file for the configured mode, then "END <count> <latency_us>"
+//   TRACK <count> [threshold]      like BATCH, but each picture is also kept (by id) for UPDATE
+//   UPDATE <id> <rects> [threshold]  followed by <rects> dirty rectangles "<i0> <j0> <h> <w>" + h*w pixels
+//   -> the result lines of the updated picture, then "END 1 <latency_us> rescored <x> refreshed <y>"
+//   FORGET <id> -> OK, drops a tracked picture
+//   PING  -> PONG
+//   STATS -> STATS requests <r> pictures <p> p50_us <x> p99_us <y> max_us <z>
+//   QUIT  -> BYE, and the daemon exits
+//
+// A malformed batch is answered with "ERR <reason>" and the connection is closed, since the stream can
+// no longer be parsed. The latency is measured from the BATCH line to the flushed END line.
+
+typedef struct{
+    double* lat;
+    int n;
+    int cap;
+    long long pictures;
+}
+DaemonStats;
+
+// Pictures kept for incremental updates, looked up by id.
+typedef struct{
+    int* ids;
+    PdsFrame** frames;
+    int n;
+    int cap;
+}
+TrackedSet;
+
+static int tracked_find(const TrackedSet* t,int id){
+ for(int i=0;i<t->n;++i)
+ if(t->ids[i]==id) return i;
+ return -1;
+}
+
+// Stores f under id, replacing (and freeing) an older frame of the same picture.
+static bool tracked_put(TrackedSet* t,int id,PdsFrame* f){
+ int i=tracked_find(t,id);
+ if(i>=0){
+    pds_frame_destroy(t->frames[i]);
+    t->frames[i]=f;
+    return true;
+}
+ if(t->n==t->cap){
+    int cap=t->cap?2*t->cap:16;
+    int* ids=(int*)realloc(t->ids,(size_t)cap*sizeof(int));
+    if(ids) t->ids=ids;
+    PdsFrame** fr=(PdsFrame**)realloc(t->frames,(size_t)cap*sizeof(PdsFrame*));
+    if(fr) t->frames=fr;
+    if(!ids||!fr)
+    return false;
+    t->cap=cap;
+}
+ t->ids[t->n]=id;
+ t->frames[t->n++]=f;
+ return true;
+}
+
+static void tracked_drop(TrackedSet* t,int i){
+ pds_frame_destroy(t->frames[i]);
+ t->ids[i]=t->ids[t->n-1];
+ t->frames[i]=t->frames[t->n-1];
+ t->n--;
+}
+
+static double now_us(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC,&ts);
+ return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+static void stats_push(DaemonStats* st,double us,int pictures){
+ if(st->n==st->cap){
+    int cap=st->cap?2*st->cap:1024;
+    double* a=(double*)realloc(st->lat,(size_t)cap*sizeof(double));
+    if(!a)
+    return;
+    st->lat=a;
+    st->cap=cap;
+}
+ st->lat[st->n++]=us;
+ st->pictures+=pictures;
+}
+
+static int cmp_double(const void* x,const void* y){
+ double a=*(const double*)x, b=*(const double*)y;
+ return (a>b)-(a<b);
+}
+
+// Prints the request counters and the latency percentiles (nearest rank) of all batches served so far.
+static void stats_print(FILE* f,const DaemonStats* st){
+ double p50=0, p99=0, mx=0;
+ if(st->n>0){
+    double* s=(double*)malloc((size_t)st->n*sizeof(double));
+    if(s){
+        memcpy(s,st->lat,(size_t)st->n*sizeof(double));
+        qsort(s,(size_t)st->n,sizeof(double),cmp_double);
+        p50=s[(st->n-1)/2];
+        p99=s[(int)((st->n-1)*0.99)];
+        mx=s[st->n-1];
+        free(s);
+    }
+}
+ fprintf(f,"STATS requests %d pictures %lld p50_us %.0f p99_us %.0f max_us %.0f\n",st->n,st->pictures,p50,p99,mx);
+}
+
+// Runs the context's search on every picture of one batch and prints the results in the output file format.
+static bool answer_batch(FILE* out,Picture* pics,int count,PdsContext* ctx,double threshold){
+ const PdsOptions* opt=pds_options(ctx);
+ if(opt->mode==SEARCH_ALL){
+    MatchList* l=(MatchList*)calloc((size_t)count+1,sizeof(MatchList));
+    if(!l)
+    return false;
+    bool ok=true;
+    for(int i=0;i<count && ok;++i)
+    ok=pds_search_all(ctx,&pics[i],threshold,&l[i])>=0;
+    if(ok)
+    print_output_all(out,l,count);
+    for(int i=0;i<count;++i)
+    match_list_free(&l[i]);
+    free(l);
+    return ok;
+}
+ MatchResult* r=(MatchResult*)malloc(((size_t)count+1)*sizeof(MatchResult));
+ if(!r)
+ return false;
+ for(int i=0;i<count;++i)
+ pds_search(ctx,&pics[i],threshold,&r[i]);
+ if(opt->mode==SEARCH_BEST)
+ print_output_best(out,r,count);
+ else if(opt->symmetric)
+ print_output_oriented(out,r,count);
+ else print_output(out,r,count);
+ free(r);
+ return true;
+}
+
+// Answers one tracked picture from its cached planes, in the output file format of the context's mode.
+static bool answer_frame(FILE* out,PdsContext* ctx,PdsFrame* f,double threshold){
+ if(pds_options(ctx)->mode==SEARCH_ALL){
+    MatchList l={0,0,0,NULL};
+    bool ok=pds_frame_search_all(ctx,f,threshold,&l)>=0;
+    if(ok)
+    print_output_all(out,&l,1);
+    match_list_free(&l);
+    return ok;
+}
+ MatchResult r;
+ pds_frame_search(ctx,f,threshold,&r);
+ if(pds_options(ctx)->mode==SEARCH_BEST)
+ print_output_best(out,&r,1);
+ else print_output(out,&r,1);
+ return true;
+}
+
+// Reads the dirty rectangles of an UPDATE request and applies them to a tracked picture; with f == NULL 
+// they are only read and discarded (an UPDATE of a picture that isn't tracked).
+static bool apply_update(FILE* in,PdsContext* ctx,PdsFrame* f,int rects){
+ for(int r=0;r<rects;++r){
+    int i0,j0,h,w;
+    if(fscanf(in,"%d %d %d %d",&i0,&j0,&h,&w)!=4 || h<0 || w<0)
+    return false;
+    int* px=(int*)malloc(((size_t)h*w+1)*sizeof(int));
+    if(!px)
+    return false;
+    bool ok=true;
+    for(size_t t=0;t<(size_t)h*w && ok;++t)
+    ok=fscanf(in,"%d",&px[t])==1;
+    ok=ok && (!f || pds_frame_update(ctx,f,i0,j0,h,w,px));
+    free(px);
+    if(!ok)
+    return false;
+}
+ return true;
+}
+
+// This function serves one client until it disconnects (returns 0), sends QUIT (returns 1) or sends a
+// batch that cannot be parsed (returns 0 after an ERR line). Pictures of a batch are searched one after
+// another; each search already uses the whole thread pool.
+static int serve_stream(FILE* in,FILE* out,PdsContext* ctx,double defaultThreshold,DaemonStats* st,TrackedSet* tracked){
+ char line[256];
+ while(fgets(line,sizeof line,in)){
+    char cmd[16];
+    if(sscanf(line,"%15s",cmd)!=1)
+    continue;
+    if(strcmp(cmd,"PING")==0){
+        fputs("PONG\n",out);
+        fflush(out);
+        continue;
+    }
+    if(strcmp(cmd,"STATS")==0){
+        stats_print(out,st);
+        fflush(out);
+        continue;
+    }
+    if(strcmp(cmd,"QUIT")==0){
+        fputs("BYE\n",out);
+        fflush(out);
+        return 1;
+    }
+    if(strcmp(cmd,"FORGET")==0){
+        int id=0;
+        int i=sscanf(line,"%*s %d",&id)==1?tracked_find(tracked,id):-1;
+        if(i>=0) tracked_drop(tracked,i);
+        fputs(i>=0?"OK\n":"ERR unknown picture\n",out);
+        fflush(out);
+        continue;
+    }
+    if(strcmp(cmd,"UPDATE")==0){
+        const double t0=now_us();
+        int id=0, rects=0;
+        double threshold=defaultThreshold;
+        if(sscanf(line,"%*s %d %d %lf",&id,&rects,&threshold)<2 || rects<0){
+            fputs("ERR bad UPDATE header\n",out);
+            fflush(out);
+            return 0;
+        }
+        const int i=tracked_find(tracked,id);
+        if(i<0){
+            // The request itself is well formed, so the client stays connected once its data is skipped
+            const bool skipped=apply_update(in,ctx,NULL,rects);
+            fputs(skipped?"ERR unknown picture\n":"ERR bad update data\n",out);
+            fflush(out);
+            if(!skipped)
+            return 0;
+            continue;
+        }
+        PdsFrame* f=tracked->frames[i];
+        long long rs0,rf0,rs1,rf1;
+        pds_frame_stats(f,&rs0,&rf0);
+        if(!apply_update(in,ctx,f,rects)){
+            // The picture may be half updated now, so it is dropped
+            tracked_drop(tracked,i);
+            fputs("ERR bad update data\n",out);
+            fflush(out);
+            return 0;
+        }
+        if(!answer_frame(out,ctx,f,threshold)){
+            fputs("ERR out of memory\n",out);
+            fflush(out);
+            return 0;
+        }
+        pds_frame_stats(f,&rs1,&rf1);
+        const double us=now_us()-t0;
+        fprintf(out,"END 1 %.0f rescored %lld refreshed %lld\n",us,rs1-rs0,rf1-rf0);
+        fflush(out);
+        stats_push(st,us,1);
+        continue;
+    }
+    const bool track=strcmp(cmd,"TRACK")==0;
+    if(!track && strcmp(cmd,"BATCH")!=0){
+        fprintf(out,"ERR unknown command %s\n",cmd);
+        fflush(out);
+        continue;
+    }
+    const double t0=now_us();
+    int count=0;
+    double threshold=defaultThreshold;
+    if(sscanf(line,"%*s %d %lf",&count,&threshold)<1 || count<0){
+        fputs("ERR bad BATCH header\n",out);
+        fflush(out);
+        return 0;
+    }
+    Picture* pics=(Picture*)calloc((size_t)count+1,sizeof(Picture));
+    int got=0;
+    while(pics && got<count && read_picture(in,&pics[got]))
+    got++;
+    bool ok=pics && got==count;
+    if(!ok)
+    fputs("ERR bad picture data\n",out);
+    else if(track){
+        for(int i=0;i<count && ok;++i){
+            PdsFrame* f=pds_frame_create(ctx,&pics[i]);
+            // Once tracked the frame belongs to the set; until then it is ours to free
+            ok=f && tracked_put(tracked,pics[i].id,f);
+            if(f && !ok)
+            pds_frame_destroy(f);
+            ok=ok && answer_frame(out,ctx,f,threshold);
+            if(!f)
+            fputs("ERR cannot track picture (symmetric search or out of memory)\n",out);
+            else if(!ok)
+            fputs("ERR out of memory\n",out);
+        }
+    }
+    else if(!answer_batch(out,pics,count,ctx,threshold)){
+        fputs("ERR out of memory\n",out);
+        ok=false;
+    }
+    for(int i=0;i<got;++i)
+    free(pics[i].a);
+    free(pics);
+    if(!ok){
+        fflush(out);
+        return 0;
+    }
+    const double us=now_us()-t0;
+    fprintf(out,"END %d %.0f\n",count,us);
+    fflush(out);
+    stats_push(st,us,count);
+}
+ return 0;
+}
+
+// This function is the daemon's main loop. endpoint "-" serves a single session on stdin/stdout; anything
+// else is the path of a UNIX domain socket that is (re)created and accepts clients one at a time until a
+// client sends QUIT. The OpenMP pool is started before the first request so that no batch pays for
+// spawning threads (the runtime keeps them between parallel regions). Returns 0 on a clean shutdown.
+int run_daemon(const char* endpoint,PdsContext* ctx,double threshold){
+ DaemonStats st={NULL,0,0,0};
+ TrackedSet tracked={NULL,NULL,0,0};
+ int threads=1;
+ const int want=pds_options(ctx)->threads;
+ #pragma omp parallel num_threads(want>0?want:omp_get_max_threads())
+ {
+    #pragma omp single
+    threads=omp_get_num_threads();
+ }
+ if(strcmp(endpoint,"-")==0){
+    fprintf(stderr,"[daemon] %d threads, serving stdin\n",threads);
+    serve_stream(stdin,stdout,ctx,threshold,&st,&tracked);
+    stats_print(stderr,&st);
+    while(tracked.n>0) tracked_drop(&tracked,0);
+    free(tracked.ids);
+    free(tracked.frames);
+    free(st.lat);
+    return 0;
+}
+ struct sockaddr_un addr;
+ memset(&addr,0,sizeof addr);
+ addr.sun_family=AF_UNIX;
+ if(strlen(endpoint)>=sizeof addr.sun_path){
+    fprintf(stderr,"[daemon] socket path too long: %s\n",endpoint);
+    return 1;
+}
+ strcpy(addr.sun_path,endpoint);
+ int srv=socket(AF_UNIX,SOCK_STREAM,0);
+ if(srv<0){
+    perror("[daemon] socket");
+    return 1;
+}
+ unlink(endpoint);
+ if(bind(srv,(struct sockaddr*)&addr,sizeof addr)!=0 || listen(srv,16)!=0){
+    perror("[daemon] bind");
+    close(srv);
+    return 1;
+}
+ // A client that disconnects mid-answer must not kill the daemon
+ signal(SIGPIPE,SIG_IGN);
+ fprintf(stderr,"[daemon] %d threads, listening on %s\n",threads,endpoint);
+ int rc=0;
+ for(;;){
+    int c=accept(srv,NULL,NULL);
+    if(c<0){
+        if(errno==EINTR)
+        continue;
+        perror("[daemon] accept");
+        rc=1;
+        break;
+    }
+    int c2=dup(c);
+    FILE* in=fdopen(c,"r");
+    FILE* out=c2>=0?fdopen(c2,"w"):NULL;
+    int quit=0;
+    if(in && out)
+    quit=serve_stream(in,out,ctx,threshold,&st,&tracked);
+    if(in) fclose(in); else close(c);
+    if(out) fclose(out); else if(c2>=0) close(c2);
+    if(quit)
+    break;
+}
+ close(srv);
+ unlink(endpoint);
+ stats_print(stderr,&st);
+ while(tracked.n>0) tracked_drop(&tracked,0);
+ free(tracked.ids);
+ free(tracked.frames);
+ free(st.lat);
+ return rc;
+}
@@ -0,0 +1,4 @@
+#pragma once
+#include "pds.h"
+
+int run_daemon(const char* endpoint,PdsContext* ctx,double threshold);
@@ -0,0 +1,220 @@
+#include "dedup.h"
+#include "cache.h"
+#include "compute.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Inputs built by concatenating batches often repeat the same matrix under several ids. Every picture
+// (pixels and ROI) and every object (pixels and mask) is hashed with hash_ints and inserted into an
+// open-addressing table; a hash hit is confirmed by comparing the arrays, so distinct matrices are never
+// merged. Unique matrices are numbered in order of first occurrence, which keeps the relative order of
+// the objects: the first-match, best-match and sweep searches then report the id of the first copy, as
+// the full search would (it tries objects in input order and resolves ties to the earlier object).
+
+static bool same_ints(const int* a,const int* b,size_t n){
+ if(!a||!b)
+ return a==b;
+ return memcmp(a,b,n*sizeof(int))==0;
+}
+
+static bool same_picture(const Picture* x,const Picture* y){
+ if(x->N!=y->N || !same_ints(x->a,y->a,(size_t)x->N*x->N))
+ return false;
+ if(!x->roiRow || !y->roiRow)
+ return !x->roiRow && !y->roiRow;
+ return same_ints(x->roiRow,y->roiRow,(size_t)x->N+1) && same_ints(x->roiSpan,y->roiSpan,(size_t)x->roiRow[x->N]*2);
+}
+
+static bool same_object(const ObjectT* x,const ObjectT* y){
+ if(x->n!=y->n || !same_ints(x->a,y->a,(size_t)x->n*x->n))
+ return false;
+ if(!x->maskRow || !y->maskRow)
+ return !x->maskRow && !y->maskRow;
+ const size_t active=(size_t)x->maskRow[x->n];
+ return same_ints(x->maskRow,y->maskRow,(size_t)x->n+1) && same_ints(x->maskCol,y->maskCol,active) && same_ints(x->maskVal,y->maskVal,active);
+}
+
+static unsigned long long picture_hash(const void* items,int t){
+ const Picture* p=&((const Picture*)items)[t];
+ unsigned long long h=hash_ints(p->a,(size_t)p->N*p->N,(unsigned long long)p->N);
+ if(p->roiRow)
+ h=hash_ints(p->roiSpan,(size_t)p->roiRow[p->N]*2,hash_ints(p->roiRow,(size_t)p->N+1,h));
+ return h;
+}
+
+static unsigned long long object_hash(const void* items,int t){
+ const ObjectT* o=&((const ObjectT*)items)[t];
+ unsigned long long h=hash_ints(o->a,(size_t)o->n*o->n,(unsigned long long)o->n);
+ if(o->maskRow)
+ h=hash_ints(o->maskCol,(size_t)o->maskRow[o->n],hash_ints(o->maskRow,(size_t)o->n+1,h));
+ return h;
+}
+
+static bool picture_equal(const void* items,int x,int y){
+ return same_picture(&((const Picture*)items)[x],&((const Picture*)items)[y]);
+}
+
+static bool object_equal(const void* items,int x,int y){
+ return same_object(&((const ObjectT*)items)[x],&((const ObjectT*)items)[y]);
+}
+
+static int cmp_int(const void* x,const void* y){
+ const int a=*(const int*)x, b=*(const int*)y;
+ return (a>b)-(a<b);
+}
+
+// Fills of[0..n) with the unique index of every item and first[] with the first item of every unique
+// index. Returns the number of unique items, or -1 if memory runs out.
+static int dedup_items(const void* items,int n,unsigned long long (*hash)(const void*,int),bool (*equal)(const void*,int,int),int* of,int* first){
+ size_t cap=16;
+ while(cap<2*(size_t)n) cap*=2;
+ int* slot=(int*)malloc(cap*sizeof(int));
+ unsigned long long* hs=(unsigned long long*)malloc(((size_t)n+1)*sizeof(unsigned long long));
+ if(!slot||!hs){
+    free(slot);
+    free(hs);
+    return -1;
+}
+ for(size_t s=0;s<cap;++s)
+ slot[s]=-1;
+ int u=0;
+ for(int t=0;t<n;++t){
+    hs[t]=hash(items,t);
+    size_t s=(size_t)hs[t]&(cap-1);
+    // Probe until an equal item (a copy) or an empty slot (a new matrix)
+    while(slot[s]>=0 && !(hs[first[slot[s]]]==hs[t] && equal(items,first[slot[s]],t)))
+    s=(s+1)&(cap-1);
+    if(slot[s]<0){
+        slot[s]=u;
+        first[u++]=t;
+    }
+    of[t]=slot[s];
+}
+ free(slot);
+ free(hs);
+ return u;
+}
+
+// This function builds the deduplication maps of the input. Objects are only merged when 'objects' is
+// set and every unique object keeps a distinct id, since the all-matches expansion tells the hits of
+// unique objects apart by id; otherwise every object stays unique. Returns false if memory runs out.
+bool dedup_build(Dedup* d,const Picture* pics,int P,const ObjectT* objs,int M,bool objects){
+ memset(d,0,sizeof *d);
+ d->P=P;
+ d->M=M;
+ d->picOf=(int*)malloc(((size_t)P+1)*sizeof(int));
+ d->picFirst=(int*)malloc(((size_t)P+1)*sizeof(int));
+ d->picId=(int*)malloc(((size_t)P+1)*sizeof(int));
+ d->objOf=(int*)malloc(((size_t)M+1)*sizeof(int));
+ d->objFirst=(int*)malloc(((size_t)M+1)*sizeof(int));
+ d->objId=(int*)malloc(((size_t)M+1)*sizeof(int));
+ if(!d->picOf||!d->picFirst||!d->picId||!d->objOf||!d->objFirst||!d->objId){
+    dedup_free(d);
+    return false;
+}
+ for(int i=0;i<P;++i)
+ d->picId[i]=pics[i].id;
+ for(int k=0;k<M;++k){
+    d->objId[k]=objs[k].id;
+    d->objOf[k]=d->objFirst[k]=k;
+}
+ d->Pu=dedup_items(pics,P,picture_hash,picture_equal,d->picOf,d->picFirst);
+ d->Mu=M;
+ if(d->Pu<0){
+    dedup_free(d);
+    return false;
+}
+ if(objects){
+    int* of=(int*)malloc(((size_t)M+1)*sizeof(int));
+    int* first=(int*)malloc(((size_t)M+1)*sizeof(int));
+    const int mu=of&&first?dedup_items(objs,M,object_hash,object_equal,of,first):-1;
+    // The ids of the unique objects, sorted, must not repeat
+    int* ids=mu>=0?(int*)malloc(((size_t)mu+1)*sizeof(int)):NULL;
+    bool distinct=ids!=NULL;
+    for(int x=0;x<mu && distinct;++x)
+    ids[x]=objs[first[x]].id;
+    if(distinct)
+    qsort(ids,(size_t)mu,sizeof(int),cmp_int);
+    for(int x=1;x<mu && distinct;++x)
+    distinct=ids[x]!=ids[x-1];
+    free(ids);
+    if(distinct){
+        memcpy(d->objOf,of,(size_t)M*sizeof(int));
+        memcpy(d->objFirst,first,(size_t)mu*sizeof(int));
+        d->Mu=mu;
+    }
+    free(of);
+    free(first);
+}
+ return true;
+}
+
+void dedup_free(Dedup* d){
+ free(d->picOf);
+ free(d->picFirst);
+ free(d->picId);
+ free(d->objOf);
+ free(d->objFirst);
+ free(d->objId);
+ memset(d,0,sizeof *d);
+}
+
+// Expands one single-result answer per unique picture to one per input picture. The object ids are
+// already those of the first copies, so only the picture id changes.
+MatchResult* dedup_expand_results(const Dedup* d,const MatchResult* u){
+ MatchResult* r=(MatchResult*)malloc(((size_t)d->P+1)*sizeof(MatchResult));
+ if(!r)
+ return NULL;
+ for(int i=0;i<d->P;++i){
+    r[i]=u[d->picOf[i]];
+    r[i].pictureId=d->picId[i];
+}
+ return r;
+}
+
+// Expands the all-matches lists of the unique pictures to the input pictures. The hits of a list are
+// grouped by unique object in order, so they are split into one block per unique object and the blocks
+// are then written once per input object (in input order, under that object's id), which is the order
+// find_all_matches_for_picture produces for the full input. Returns NULL if memory runs out.
+MatchList* dedup_expand_lists(const Dedup* d,const MatchList* u){
+ MatchList* r=(MatchList*)calloc((size_t)d->P+1,sizeof(MatchList));
+ int* start=(int*)malloc(((size_t)d->Mu+1)*sizeof(int));
+ bool ok=r&&start;
+ for(int i=0;i<d->P && ok;++i){
+    const MatchList* src=&u[d->picOf[i]];
+    // Block boundaries: start[x]..start[x+1] are the hits of unique object x
+    int h=0;
+    for(int x=0;x<d->Mu;++x){
+        start[x]=h;
+        const int id=d->objId[d->objFirst[x]];
+        while(h<src->count && src->hits[h].objectId==id) h++;
+    }
+    start[d->Mu]=h;
+    int total=0;
+    for(int k=0;k<d->M;++k)
+    total+=start[d->objOf[k]+1]-start[d->objOf[k]];
+    r[i].pictureId=d->picId[i];
+    r[i].hits=(MatchHit*)malloc((size_t)(total>0?total:1)*sizeof(MatchHit));
+    if(!r[i].hits){
+        ok=false;
+        break;
+    }
+    r[i].cap=total;
+    for(int k=0;k<d->M;++k){
+        const int x=d->objOf[k];
+        for(int e=start[x];e<start[x+1];++e){
+            MatchHit* m=&r[i].hits[r[i].count++];
+            *m=src->hits[e];
+            m->objectId=d->objId[k];
+        }
+    }
+}
+ free(start);
+ if(!ok && r){
+    for(int i=0;i<d->P;++i)
+    match_list_free(&r[i]);
+    free(r);
+    return NULL;
+}
+ return r;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdbool.h>
+#include "types.h"
+
+// In-run deduplication of identical pictures and objects (see dedup.c). Rank 0 builds it right after
+// reading the input, broadcasts and searches only the unique matrices, and expands the results back to
+// every input id before writing.
+typedef struct{
+    int P, M;        // input pictures / objects
+    int Pu, Mu;      // unique pictures / objects
+    int* picOf;      // input picture -> unique picture
+    int* picFirst;   // unique picture -> its first input picture
+    int* picId;      // input picture ids
+    int* objOf;      // input object -> unique object
+    int* objFirst;   // unique object -> its first input object
+    int* objId;      // input object ids
+}
+Dedup;
+
+bool dedup_build(Dedup* d,const Picture* pics,int P,const ObjectT* objs,int M,bool objects);
+void dedup_free(Dedup* d);
+MatchResult* dedup_expand_results(const Dedup* d,const MatchResult* u);
+MatchList* dedup_expand_lists(const Dedup* d,const MatchList* u);
@@ -0,0 +1,262 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic workload generator. It writes an input file in the text format or in the binary format (see
+// read_input_binary in io.c), fully determined by the options and the seed: the random numbers come from a
+// splitmix64 stream and the pixels are drawn with integer and plain double arithmetic only, so a seed gives
+// the same file on every machine.
+//
+// Picture and object sizes are drawn uniformly from their ranges, pixel values from a uniform, a gaussian
+// (sum of four uniforms) or a flat distribution over [lo,hi]. A fraction of the pictures gets one copy of a
+// random object planted at a random position; every planted pixel is o/(1-u) for a uniform u in
+// [-f,f], so its term of the score is about |u|. 'noise' is f for the smallest object size, larger and masked
+// objects get f scaled down by their share of active pixels, so every planted copy scores about
+// noise*nmin^2/2. The planted positions and their exact scores go to the --truth file. Unless --threshold is
+// given, the threshold is set just above the highest planted score (it is patched into the header once the
+// pictures are written), so every planted copy matches while random windows score far above it.
+//
+// --no-match writes a near-miss input instead: pictures and objects draw from the same narrow band around
+// the middle of the range, so the value-range and pair prefilters can't rule anything out, and the
+// threshold is well below the expected window score of the smallest object, so no window matches but the
+// bounded kernels still compare many pixels of every window before they give up. That threshold is six
+// standard deviations below the expected window score, so objects of 8x8 and more are needed for it to be
+// positive.
+//
+//   pds_gen <output> [--format text|binary] [--seed S] [--pictures P] [--objects M] [--size A:B]
+//           [--object-size a:b] [--values uniform|gauss|flat] [--range lo:hi] [--plant F] [--noise f]
+//           [--mask f] [--no-match] [--threshold t] [--truth file]
+
+typedef struct{
+    FILE* f;
+    int binary;
+}
+Writer;
+
+static unsigned long long state;
+
+static unsigned long long next_u64(void){
+ unsigned long long z=(state+=0x9E3779B97F4A7C15ULL);
+ z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+ z=(z^(z>>27))*0x94D049BB133111EBULL;
+ return z^(z>>31);
+}
+
+// Uniform in [0,1) with 53 random bits
+static double next_unit(void){
+ return (double)(next_u64()>>11)*(1.0/9007199254740992.0);
+}
+
+// Uniform integer in [lo,hi]
+static int next_int(int lo,int hi){
+ return lo+(int)(next_u64()%(unsigned long long)(hi-lo+1));
+}
+
+static int clamp(int v,int lo,int hi){
+ return v<lo?lo:v>hi?hi:v;
+}
+
+// One pixel of the chosen distribution over [lo,hi]
+static int next_value(const char* dist,int lo,int hi){
+ if(strcmp(dist,"flat")==0)
+ return lo+(hi-lo)/2;
+ if(strcmp(dist,"gauss")==0){
+    // Irwin-Hall: the mean of four uniforms, centred on the range with a standard deviation of range/6.9
+    const double g=(next_unit()+next_unit()+next_unit()+next_unit())/4.0;
+    return clamp(lo+(int)(g*(hi-lo)+0.5),lo,hi);
+}
+ return next_int(lo,hi);
+}
+
+static int parse_range(const char* s,int* lo,int* hi){
+ return sscanf(s,"%d:%d",lo,hi)==2 && *lo<=*hi;
+}
+
+static void put_int(Writer* w,int v){
+ if(w->binary) fwrite(&v,sizeof v,1,w->f);
+ else fprintf(w->f,"%d\n",v);
+}
+
+// Writes an id, a size and the k*k pixels; a negative pixel is a masked one ('*' in the text format)
+static void put_matrix(Writer* w,int id,int k,const int* a){
+ put_int(w,id);
+ put_int(w,k);
+ if(w->binary){
+    fwrite(a,sizeof(int),(size_t)k*k,w->f);
+    return;
+}
+ for(int r=0;r<k;++r){
+    for(int c=0;c<k;++c)
+    if(a[r*k+c]<0) fputs(c?" *":"*",w->f);
+    else fprintf(w->f,c?" %d":"%d",a[r*k+c]);
+    fputc('\n',w->f);
+}
+}
+
+int main(int argc,char** argv){
+ if(argc<2){
+    fprintf(stderr,"Usage: %s <output> [--format text|binary] [--seed S] [--pictures P] [--objects M] [--size A:B] "
+                   "[--object-size a:b] [--values uniform|gauss|flat] [--range lo:hi] [--plant F] [--noise f] [--mask f] "
+                   "[--no-match] [--threshold t] [--truth file]\n",argv[0]);
+    return 1;
+}
+ int P=8, M=8, Nlo=64, Nhi=128, nlo=4, nhi=16, lo=1, hi=255, binary=0, noMatch=0;
+ double plant=0.5, noise=0.05, mask=0.0, threshold=-1.0;
+ unsigned long long seed=1;
+ const char* dist="uniform";
+ const char* truthPath=NULL;
+ for(int a=2;a<argc;++a){
+    if(strcmp(argv[a],"--format")==0 && a+1<argc) binary=strcmp(argv[++a],"binary")==0;
+    else if(strcmp(argv[a],"--seed")==0 && a+1<argc) seed=strtoull(argv[++a],NULL,10);
+    else if(strcmp(argv[a],"--pictures")==0 && a+1<argc) P=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--objects")==0 && a+1<argc) M=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--size")==0 && a+1<argc && parse_range(argv[a+1],&Nlo,&Nhi)) a++;
+    else if(strcmp(argv[a],"--object-size")==0 && a+1<argc && parse_range(argv[a+1],&nlo,&nhi)) a++;
+    else if(strcmp(argv[a],"--values")==0 && a+1<argc) dist=argv[++a];
+    else if(strcmp(argv[a],"--range")==0 && a+1<argc && parse_range(argv[a+1],&lo,&hi)) a++;
+    else if(strcmp(argv[a],"--plant")==0 && a+1<argc) plant=atof(argv[++a]);
+    else if(strcmp(argv[a],"--noise")==0 && a+1<argc) noise=atof(argv[++a]);
+    else if(strcmp(argv[a],"--mask")==0 && a+1<argc) mask=atof(argv[++a]);
+    else if(strcmp(argv[a],"--no-match")==0) noMatch=1;
+    else if(strcmp(argv[a],"--threshold")==0 && a+1<argc) threshold=atof(argv[++a]);
+    else if(strcmp(argv[a],"--truth")==0 && a+1<argc) truthPath=argv[++a];
+    else {
+        fprintf(stderr,"Unknown or malformed option %s\n",argv[a]);
+        return 1;
+    }
+}
+ if(P<0||M<1||nlo<1||nhi>Nlo||lo<1||noise<0||noise>=1||mask<0||mask>=1||plant<0||plant>1){
+    fprintf(stderr,"need objects >= 1, 1 <= object sizes <= picture sizes, pixel values >= 1, noise and mask in [0,1), plant in [0,1]\n");
+    return 1;
+}
+ if(strcmp(dist,"uniform")!=0 && strcmp(dist,"gauss")!=0 && strcmp(dist,"flat")!=0){
+    fprintf(stderr,"values must be uniform, gauss or flat\n");
+    return 1;
+}
+ state=seed;
+ // Near-miss band: +-5% around the middle of the range, at least +-1
+ const int mid=lo+(hi-lo)/2;
+ const int band=mid/20>1?mid/20:1;
+ const int blo=noMatch?clamp(mid-band,lo,hi):lo, bhi=noMatch?clamp(mid+band,lo,hi):hi;
+ if(noMatch){
+    dist="uniform";
+    plant=0.0;
+}
+ // The objects first: the planted copies need them
+ int* on=(int*)malloc((size_t)M*sizeof(int));
+ int** oa=(int**)malloc((size_t)M*sizeof(int*));
+ if(!on||!oa){
+    fprintf(stderr,"out of memory\n");
+    return 1;
+}
+ for(int k=0;k<M;++k){
+    const int n=next_int(nlo,nhi);
+    on[k]=n;
+    oa[k]=(int*)malloc((size_t)n*n*sizeof(int));
+    if(!oa[k]){
+        fprintf(stderr,"out of memory\n");
+        return 1;
+    }
+    for(int t=0;t<n*n;++t)
+    oa[k][t]=next_value(dist,blo,bhi);
+    // Pixel 0 always stays active, so no object is fully masked
+    for(int t=1;t<n*n && mask>0;++t)
+    if(next_unit()<mask) oa[k][t]=-1;
+}
+ const int autoThreshold=threshold<0 && !noMatch;
+ if(threshold<0){
+    if(noMatch){
+        // Mean and variance of the term |p-o|/p of two independent uniform pixels of the band; the threshold
+        // is six standard deviations below the expected score of the smallest object's active pixels
+        double e=0.0, e2=0.0;
+        for(int p=blo;p<=bhi;++p)
+        for(int o=blo;o<=bhi;++o){
+            const double d=(double)abs(p-o)/p;
+            e+=d;
+            e2+=d*d;
+        }
+        const double cells=(double)(bhi-blo+1)*(bhi-blo+1);
+        e/=cells;
+        e2/=cells;
+        const double active=0.8*nlo*nlo*(1.0-mask)>1.0?0.8*nlo*nlo*(1.0-mask):1.0;
+        threshold=active*e-6.0*sqrt(active*(e2-e*e));
+        if(threshold<0)
+        threshold=0.0;
+    }
+    else threshold=1e-6;
+}
+ Writer w={fopen(argv[1],binary?"wb":"w"),binary};
+ FILE* truth=truthPath?fopen(truthPath,"w"):NULL;
+ if(!w.f||(truthPath&&!truth)){
+    fprintf(stderr,"Failed to open output file\n");
+    return 1;
+}
+ if(binary){
+    const int version=1;
+    fwrite("PDSB",1,4,w.f);
+    fwrite(&version,sizeof version,1,w.f);
+    fwrite(&threshold,sizeof threshold,1,w.f);
+}
+ else fprintf(w.f,"%-24.17g\n",threshold);
+ put_int(&w,P);
+ int* pa=(int*)malloc((size_t)Nhi*Nhi*sizeof(int));
+ if(!pa){
+    fprintf(stderr,"out of memory\n");
+    return 1;
+}
+ int planted=0;
+ for(int i=0;i<P;++i){
+    const int N=next_int(Nlo,Nhi);
+    for(int t=0;t<N*N;++t)
+    pa[t]=next_value(dist,blo,bhi);
+    if(next_unit()<plant){
+        const int k=next_int(0,M-1), n=on[k];
+        const int r0=next_int(0,N-n), c0=next_int(0,N-n);
+        int active=0;
+        for(int t=0;t<n*n;++t)
+        active+=oa[k][t]>=0;
+        const double f=noise*nlo*nlo/active<noise?noise*nlo*nlo/active:noise;
+        double score=0.0;
+        for(int r=0;r<n;++r)
+        for(int c=0;c<n;++c){
+            const int o=oa[k][r*n+c];
+            if(o<0)
+            continue;
+            const double u=(2.0*next_unit()-1.0)*f;
+            int p=(int)(o/(1.0-u)+0.5);
+            if(p<1) p=1;
+            pa[(r0+r)*N+c0+c]=p;
+            score+=(double)abs(p-o)/p;
+        }
+        planted++;
+        if(autoThreshold && 1.01*score+1e-6>threshold)
+        threshold=1.01*score+1e-6;
+        if(truth)
+        fprintf(truth,"Picture %d Object %d Position(%d,%d) score %.9g\n",i+1,k+1,r0,c0,score);
+    }
+    put_matrix(&w,i+1,N,pa);
+}
+ put_int(&w,M);
+ for(int k=0;k<M;++k)
+ put_matrix(&w,k+1,on[k],oa[k]);
+ if(autoThreshold){
+    // Same width as the placeholder, so nothing after it moves
+    fseek(w.f,binary?8:0,SEEK_SET);
+    if(binary) fwrite(&threshold,sizeof threshold,1,w.f);
+    else fprintf(w.f,"%-24.17g",threshold);
+}
+ if(fclose(w.f)!=0){
+    fprintf(stderr,"Failed to write %s\n",argv[1]);
+    return 1;
+}
+ if(truth)
+ fclose(truth);
+ fprintf(stderr,"%s: %d pictures, %d objects, %d planted, threshold %.9g\n",argv[1],P,M,planted,threshold);
+ for(int k=0;k<M;++k)
+ free(oa[k]);
+ free(oa);
+ free(on);
+ free(pa);
+ return 0;
+}
@@ -1,6 +1,31 @@
 #include "io.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// A side length is usable if it is positive and N*N, the pixel count every kernel indexes with an int, 
+// does not overflow.
+static bool valid_size(int N){
+ return N>=1 && N<=INT_MAX/N;
+}
+
+// Frees what read_input has loaded so far after a read error. Both arrays come from calloc, so the entries 
+// that were not reached yet are all NULL; either array may be NULL itself. Returns false for the caller to 
+// pass on.
+static bool discard_input(Picture* arr,int p,ObjectT* a2,int m){
+ for(int i=0;arr && i<p;++i) 
+ free(arr[i].a);
+ for(int j=0;a2 && j<m;++j){
+    free(a2[j].a);
+    free(a2[j].maskRow);
+    free(a2[j].maskCol);
+    free(a2[j].maskVal);
+}
+ free(arr);
+ free(a2);
+ return false;
+}
 
 // This helper function reads N*N integer numbers from a file and stores them in an array. 
 // It reads the numbers one by one in row-major order (left to right, top to bottom) just like 
@@ -14,18 +39,178 @@ static int read_matrix(FILE* f,int N,int* out){
     return 1;
 }
 
+// Compacts the active pixels of an object with 'masked' masked pixels per row into maskRow/maskCol/maskVal, 
+// which is what the masked scoring kernel iterates. Objects without masked pixels keep maskRow == NULL. 
+// Returns 0 if memory runs out, otherwise 1.
+static int compact_mask(ObjectT* o,const unsigned char* active,int masked){
+ const int n=o->n;
+ if(!masked) 
+ return 1;
+ const int cnt=n*n-masked;
+ o->maskRow=(int*)malloc(((size_t)n+1)*sizeof(int));
+ o->maskCol=(int*)malloc(((size_t)cnt+1)*sizeof(int));
+ o->maskVal=(int*)malloc(((size_t)cnt+1)*sizeof(int));
+ if(!o->maskRow||!o->maskCol||!o->maskVal) 
+ return 0;
+ int t=0;
+ for(int r=0;r<n;++r){
+    o->maskRow[r]=t;
+    for(int c=0;c<n;++c){
+        if(!active[r*n+c]) 
+        continue;
+        o->maskCol[t]=c;
+        o->maskVal[t]=o->a[r*n+c];
+        t++;
+    }
+}
+ o->maskRow[n]=t;
+ return 1;
+}
+
+// This helper reads an n*n object matrix like read_matrix, but a '*' instead of a number marks a masked 
+// (don't care) pixel, see compact_mask; masked pixels are stored as 0 in 'a'. Returns 0 on a read error, 
+// otherwise 1.
+static int read_object_matrix(FILE* f,ObjectT* o){
+ const int n=o->n;
+ unsigned char* active=(unsigned char*)malloc((size_t)n*n+1);
+ if(!active) 
+ return 0;
+ int masked=0;
+ for(int i=0;i<n*n;++i){
+    active[i]=1;
+    if(fscanf(f,"%d",&o->a[i])==1) 
+    continue;
+    if(fgetc(f)!='*'){
+        free(active);
+        return 0;
+    }
+    o->a[i]=0;
+    active[i]=0;
+    masked++;
+}
+ const int ok=compact_mask(o,active,masked);
+ free(active);
+ return ok;
+}
+
+// This function reads one picture ("<id> <N>" followed by N*N pixels) from an open stream into p, which 
+// owns the new pixel array afterwards. It is shared by read_input and the daemon, which receives pictures 
+// in the same format. Returns false on a read error or bad size.
+bool read_picture(FILE* f,Picture* p){
+ int id,N; 
+ if(fscanf(f,"%d",&id)!=1||fscanf(f,"%d",&N)!=1||!valid_size(N)) 
+ return false;
+ p->id=id; 
+ p->N=N; 
+ p->roiRow=NULL; 
+ p->roiSpan=NULL; 
+ p->a=(int*)malloc((size_t)N*N*sizeof(int)); 
+ if(!p->a) 
+ return false;
+ if(!read_matrix(f,N,p->a)){
+    free(p->a);
+    p->a=NULL;
+    return false;
+}
+ return true;
+}
+
+static bool read_ints(FILE* f,int* a,size_t n){
+ return fread(a,sizeof(int),n,f)==n;
+}
+
+// Binary input (written by pds_gen --format binary): the magic "PDSB", then native-endian int32 version 1, 
+// float64 threshold, int32 P, per picture int32 id, int32 N and N*N int32 pixels, int32 M, and per object 
+// int32 id, int32 n and n*n int32 pixels where -1 marks a masked pixel. It holds the same data as the 
+// text format but loads without number parsing, which matters for large benchmark inputs. The stream is 
+// positioned after the magic. Returns false on a read error or bad size, with everything read so far freed.
+// A size is checked before its pixels are allocated, so a corrupt header can't overflow N*N.
+static bool read_input_binary(FILE* f,double* t,Picture** pics,int* P,ObjectT** objs,int* M){
+ int version=0, p=0, m=0;
+ if(!read_ints(f,&version,1) || version!=1 || fread(t,sizeof(double),1,f)!=1 || !read_ints(f,&p,1) || p<0){
+    fprintf(stderr,"Failed to read binary header\n");
+    return false;
+}
+ Picture* arr=(Picture*)calloc((size_t)p+1,sizeof(Picture)); 
+ if(!arr) 
+ return false;
+ for(int i=0;i<p;++i){
+    int hdr[2];
+    if(!read_ints(f,hdr,2) || !valid_size(hdr[1])){
+        fprintf(stderr,"Failed to read picture matrix\n");
+        return discard_input(arr,p,NULL,0);
+    }
+    arr[i].id=hdr[0];
+    arr[i].N=hdr[1];
+    arr[i].a=(int*)malloc((size_t)hdr[1]*hdr[1]*sizeof(int));
+    if(!arr[i].a || !read_ints(f,arr[i].a,(size_t)hdr[1]*hdr[1])){
+        fprintf(stderr,"Failed to read picture matrix\n");
+        return discard_input(arr,p,NULL,0);
+    }
+}
+ if(!read_ints(f,&m,1) || m<0){
+    fprintf(stderr,"Failed to read number of objects\n");
+    return discard_input(arr,p,NULL,0);
+}
+ ObjectT* a2=(ObjectT*)calloc((size_t)m+1,sizeof(ObjectT)); 
+ if(!a2) 
+ return discard_input(arr,p,NULL,0);
+ for(int j=0;j<m;++j){
+    int hdr[2];
+    if(!read_ints(f,hdr,2) || !valid_size(hdr[1])){
+        fprintf(stderr,"Failed to read object matrix\n");
+        return discard_input(arr,p,a2,m);
+    }
+    const int n=hdr[1];
+    a2[j].id=hdr[0];
+    a2[j].n=n;
+    a2[j].a=(int*)malloc((size_t)n*n*sizeof(int));
+    unsigned char* active=(unsigned char*)malloc((size_t)n*n+1);
+    if(!a2[j].a || !active || !read_ints(f,a2[j].a,(size_t)n*n)){
+        fprintf(stderr,"Failed to read object matrix\n");
+        free(active);
+        return discard_input(arr,p,a2,m);
+    }
+    int masked=0;
+    for(int x=0;x<n*n;++x){
+        active[x]=a2[j].a[x]!=-1;
+        if(active[x]) 
+        continue;
+        a2[j].a[x]=0;
+        masked++;
+    }
+    const int ok=compact_mask(&a2[j],active,masked);
+    free(active);
+    if(!ok) 
+    return discard_input(arr,p,a2,m);
+}
+ *pics=arr; 
+ *P=p; 
+ *objs=a2; 
+ *M=m; 
+ return true;
+}
+
 // This function reads the entire input file and creates all the data structures needed for the program. 
 // It first reads the threshold value, then the number of pictures and all picture data (ID, size, and 
 // matrix values). Next it reads the number of objects and all object data. For each picture and object, 
 // it allocates memory for the matrix and calls read_matrix to fill in the values. If anything goes 
-// wrong during reading, it cleans up memory and returns false. On success, it returns pointers to 
-// all the loaded data and returns true.
+// wrong during reading, it cleans up memory (discard_input) and returns false. On success, it returns pointers to 
+// all the loaded data and returns true. A file starting with "PDSB" is read as the binary format 
+// (read_input_binary).
 bool read_input(const char* path,double* t,Picture** pics,int* P,ObjectT** objs,int* M){
- FILE* f=fopen(path,"r"); 
+ FILE* f=fopen(path,"rb"); 
  if(!f){
     fprintf(stderr,"Failed to open input file: %s\n",path);
     return false;
 }
+ char magic[4];
+ if(fread(magic,1,4,f)==4 && memcmp(magic,"PDSB",4)==0){
+    const bool ok=read_input_binary(f,t,pics,P,objs,M);
+    fclose(f);
+    return ok;
+}
+ rewind(f);
  if(fscanf(f,"%lf",t)!=1){
     fprintf(stderr,"Failed to read threshold\n");
     fclose(f);
@@ -43,51 +228,39 @@ bool read_input(const char* path,double* t,Picture** pics,int* P,ObjectT** objs,
     return false;
 }
  for(int i=0;i<p;++i){
-    int id,N; 
-    if(fscanf(f,"%d",&id)!=1||fscanf(f,"%d",&N)!=1){
-        fclose(f);
-        return false;
-    }
-  arr[i].id=id; 
-  arr[i].N=N; 
-  arr[i].a=(int*)malloc((size_t)N*N*sizeof(int)); 
-  if(!arr[i].a){
-    fclose(f);
-    return false;
-}
-  if(!read_matrix(f,N,arr[i].a)){
+  if(!read_picture(f,&arr[i])){
     fprintf(stderr,"Failed to read picture matrix\n");
     fclose(f);
-    return false;
+    return discard_input(arr,p,NULL,0);
 }}
  int m; 
  if(fscanf(f,"%d",&m)!=1){
     fprintf(stderr,"Failed to read number of objects\n");
     fclose(f);
-    return false;
+    return discard_input(arr,p,NULL,0);
 }
  ObjectT* a2=(ObjectT*)calloc(m,sizeof(ObjectT)); 
  if(!a2){
     fclose(f);
-    return false;
+    return discard_input(arr,p,NULL,0);
 }
  for(int j=0;j<m;++j){
     int id,n; 
-    if(fscanf(f,"%d",&id)!=1||fscanf(f,"%d",&n)!=1){
+    if(fscanf(f,"%d",&id)!=1||fscanf(f,"%d",&n)!=1||!valid_size(n)){
         fclose(f);
-        return false;
+        return discard_input(arr,p,a2,m);
     }
   a2[j].id=id; 
   a2[j].n=n; 
   a2[j].a=(int*)malloc((size_t)n*n*sizeof(int)); 
   if(!a2[j].a){
     fclose(f);
-    return false;
+    return discard_input(arr,p,a2,m);
 }
-  if(!read_matrix(f,n,a2[j].a)){
+  if(!read_object_matrix(f,&a2[j])){
     fprintf(stderr,"Failed to read object matrix\n");
     fclose(f);
-    return false;
+    return discard_input(arr,p,a2,m);
 }}
  fclose(f); 
  *pics=arr; 
@@ -97,22 +270,378 @@ bool read_input(const char* path,double* t,Picture** pics,int* P,ObjectT** objs,
  return true;
 }
 
-// This function writes the final results to an output file in a human-readable format. 
+// This function prints the first-match results to an open stream in a human-readable format. 
 // It goes through each picture result one by one. If a match was found, it writes a line saying 
 // which picture found which object at what position. If no match was found, it writes that no 
 // objects were found for that picture. The output format is simple text that's easy to read 
-// and understand. Returns true if writing succeeds, false if the file can't be opened or written.
+// and understand. The print_* functions are the bodies of the matching write_* functions, so the daemon 
+// can answer over a socket in exactly the format of the output file.
+void print_output(FILE* f,const MatchResult* r,int P){
+ for(int i=0;i<P;++i){ 
+    if(r[i].found) 
+    fprintf(f,"Picture %d found Object %d in Position(%d,%d)\n",r[i].pictureId,r[i].objectId,r[i].posI,r[i].posJ);
+  else fprintf(f,"Picture %d No Objects were found\n",r[i].pictureId); 
+}
+}
+
+// This function writes the final results to an output file (see print_output). Returns true if writing 
+// succeeds, false if the file can't be opened.
 bool write_output(const char* path,const MatchResult* r,int P){
  FILE* f=fopen(path,"w"); 
  if(!f){
     fprintf(stderr,"Failed to open output file: %s\n",path);
     return false;
 }
+ print_output(f,r,P); 
+ fclose(f); 
+ return true;
+}
+
+// This function writes the results of the all-matches mode. Every picture gets a header line with the 
+// number of hits, followed by the hits themselves as "<objectId> <i> <j>" lines. Hits are sorted by 
+// object, row and column, so a horizontal run of matching positions in the same row is collapsed into 
+// one "<objectId> <i> <j0>-<j1>" line. This keeps the file small for flat pictures that match almost 
+// everywhere. Pictures without hits use the usual "No Objects were found" line.
+void print_output_all(FILE* f,const MatchList* l,int P){
+ for(int i=0;i<P;++i){ 
+    if(l[i].count==0){
+        fprintf(f,"Picture %d No Objects were found\n",l[i].pictureId);
+        continue;
+    }
+    fprintf(f,"Picture %d found %d matches\n",l[i].pictureId,l[i].count);
+    const MatchHit* h=l[i].hits;
+    int s=0;
+    while(s<l[i].count){
+        int e=s;
+        while(e+1<l[i].count && h[e+1].objectId==h[s].objectId && h[e+1].posI==h[s].posI && h[e+1].posJ==h[e].posJ+1) 
+        ++e;
+        if(e==s) 
+        fprintf(f,"%d %d %d\n",h[s].objectId,h[s].posI,h[s].posJ);
+        else fprintf(f,"%d %d %d-%d\n",h[s].objectId,h[s].posI,h[s].posJ,h[e].posJ);
+        s=e+1;
+    }
+}
+}
+
+bool write_output_all(const char* path,const MatchList* l,int P){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open output file: %s\n",path);
+    return false;
+}
+ print_output_all(f,l,P); 
+ fclose(f); 
+ return true;
+}
+
+// This function writes the results of the best-match mode. It is the same as write_output, but each 
+// found line also carries the score of the winning window so that runs can be compared.
+void print_output_best(FILE* f,const MatchResult* r,int P){
  for(int i=0;i<P;++i){ 
     if(r[i].found) 
-    fprintf(f,"Picture %d found Object %d in Position(%d,%d)\n",r[i].pictureId,r[i].objectId,r[i].posI,r[i].posJ);
+    fprintf(f,"Picture %d found Object %d in Position(%d,%d) with score %.6f\n",r[i].pictureId,r[i].objectId,r[i].posI,r[i].posJ,r[i].score);
   else fprintf(f,"Picture %d No Objects were found\n",r[i].pictureId); 
 }
+}
+
+bool write_output_best(const char* path,const MatchResult* r,int P){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open output file: %s\n",path);
+    return false;
+}
+ print_output_best(f,r,P); 
+ fclose(f); 
+ return true;
+}
+
+// This function writes the results of the top-K mode. Picture idx owns the slots r[idx*K .. idx*K+counts[idx]-1], 
+// already sorted from best to worst. Each picture gets a header with the number of candidates, followed by 
+// one "<objectId> <i> <j> <score>" line per candidate.
+bool write_output_topk(const char* path,const int* pictureIds,const ScoredMatch* r,const int* counts,int K,int P){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open output file: %s\n",path);
+    return false;
+}
+ for(int i=0;i<P;++i){ 
+    if(counts[i]==0){
+        fprintf(f,"Picture %d No Objects were found\n",pictureIds[i]);
+        continue;
+    }
+    fprintf(f,"Picture %d found %d best matches\n",pictureIds[i],counts[i]);
+    for(int e=0;e<counts[i];++e){
+        const ScoredMatch* m=&r[(size_t)i*K+e];
+        fprintf(f,"%d %d %d %.6f\n",m->objectId,m->posI,m->posJ,m->score);
+    }
+}
+ fclose(f); 
+ return true;
+}
+
+// This function writes the results of a threshold sweep. There is one section per threshold, in the 
+// order the thresholds were given, each starting with a "Threshold <t>" line followed by the usual 
+// per-picture lines. The result of picture i for threshold x is r[x*P+i].
+bool write_output_sweep(const char* path,const double* thresholds,int T,const MatchResult* r,int P){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open output file: %s\n",path);
+    return false;
+}
+ for(int x=0;x<T;++x){
+    fprintf(f,"Threshold %g\n",thresholds[x]);
+    for(int i=0;i<P;++i){ 
+        const MatchResult* m=&r[(size_t)x*P+i];
+        if(m->found) 
+        fprintf(f,"Picture %d found Object %d in Position(%d,%d)\n",m->pictureId,m->objectId,m->posI,m->posJ);
+        else fprintf(f,"Picture %d No Objects were found\n",m->pictureId); 
+    }
+}
+ fclose(f); 
+ return true;
+}
+
+// This function writes the results of the match-matrix mode as a sparse pair list: one line per 
+// (picture, object) pair that matched, giving the first position of the object in that picture. Pairs 
+// that did not match are simply left out.
+bool write_output_pairs(const char* path,const MatchResult* r,long long count){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open output file: %s\n",path);
+    return false;
+}
+ for(long long i=0;i<count;++i) 
+ fprintf(f,"Picture %d Object %d Position(%d,%d)\n",r[i].pictureId,r[i].objectId,r[i].posI,r[i].posJ);
+ fclose(f); 
+ return true;
+}
+
+// Name of a run phase in the report and the trace; PHASE_COUNT is the total.
+const char* run_phase_name(int p){
+ static const char* names[PHASE_COUNT+1]={"parse","distribute","compute","gather","write","total"};
+ return p>=0 && p<=PHASE_COUNT?names[p]:"?";
+}
+
+// Name of an orientation code of the symmetric search (see orient_src in compute.c).
+const char* orientation_name(int code){
+ static const char* const names[8]={"rot0","rot90","rot180","rot270","flipH","transpose","flipV","antitranspose"};
+ return (code>=0 && code<8)?names[code]:"?";
+}
+
+static void print_hot_counters(FILE* f,const HotCounters* c){
+ fprintf(f,"\"windows\": %lld, \"pixels\": %lld, \"abandoned\": %lld, \"repeated\": %lld, \"clustered\": %lld, \"sampled\": %lld, \"pairs\": %lld, \"cancelled\": %lld",
+         c->windows,c->pixels,c->abandoned,c->repeated,c->clustered,c->sampled,c->pairs,c->cancelled);
+}
+
+// This function writes the run report as JSON: for every phase (and the total) the min/avg/max time over
+// the ranks, the imbalance max/avg (1 when nothing was timed) and the time of every rank in rank order.
+// With counters it adds a "counters" object holding the total, the per-object and the per-picture records.
+bool write_run_report(const char* path,const RunReport* r){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open report file: %s\n",path);
+    return false;
+}
+ fprintf(f,"{\n  \"ranks\": %d,\n  \"phases\": [\n",r->ranks);
+ for(int p=0;p<=PHASE_COUNT;++p){
+    fprintf(f,"    {\"name\": \"%s\", \"min\": %.6f, \"avg\": %.6f, \"max\": %.6f, \"imbalance\": %.4f, \"per_rank\": [",
+            run_phase_name(p),r->min[p],r->avg[p],r->max[p],r->avg[p]>0.0?r->max[p]/r->avg[p]:1.0);
+    for(int q=0;q<r->ranks;++q) 
+    fprintf(f,"%s%.6f",q?", ":"",r->perRank[(size_t)q*(PHASE_COUNT+1)+p]);
+    fprintf(f,"]}%s\n",p<PHASE_COUNT?",":"");
+}
+ fprintf(f,"  ]");
+ if(r->total){
+    fprintf(f,",\n  \"counters\": {\n    \"total\": {");
+    print_hot_counters(f,r->total);
+    fprintf(f,"},\n    \"objects\": [");
+    for(int k=0;k<r->objectCount;++k){
+        fprintf(f,"%s\n      {\"id\": %d, ",k?",":"",r->objectIds[k]);
+        print_hot_counters(f,&r->objects[k]);
+        fprintf(f,"}");
+    }
+    fprintf(f,"\n    ],\n    \"pictures\": [");
+    for(int i=0;i<r->pictureCount;++i){
+        fprintf(f,"%s\n      {\"id\": %lld, ",i?",":"",r->pictures[i].pictureId);
+        print_hot_counters(f,&r->pictures[i].c);
+        fprintf(f,"}");
+    }
+    fprintf(f,"\n    ]\n  }");
+}
+ fprintf(f,"\n}\n");
+ fclose(f); 
+ return true;
+}
+
+typedef struct{
+    int pic;
+    int row;
+    int j0;
+    int j1;
+} 
+RoiInterval;
+
+static int cmp_roi_interval(const void* x,const void* y){
+ const RoiInterval* a=(const RoiInterval*)x;
+ const RoiInterval* b=(const RoiInterval*)y;
+ if(a->pic!=b->pic) 
+ return a->pic-b->pic;
+ if(a->row!=b->row) 
+ return a->row-b->row;
+ return a->j0-b->j0;
+}
+
+static bool push_roi_interval(RoiInterval** v,int* n,int* cap,int pic,int row,int j0,int j1){
+ if(*n==*cap){
+    int c=*cap?*cap*2:256;
+    RoiInterval* a=(RoiInterval*)realloc(*v,(size_t)c*sizeof(RoiInterval));
+    if(!a) 
+    return false;
+    *v=a;
+    *cap=c;
+}
+ (*v)[*n].pic=pic;
+ (*v)[*n].row=row;
+ (*v)[*n].j0=j0;
+ (*v)[*n].j1=j1;
+ (*n)++;
+ return true;
+}
+
+// This function reads a region-of-interest file and attaches the allowed top-left positions to the 
+// pictures. Each entry starts with a picture id and is either a rectangle or a bitmask:
+//   <picId> rect <i0> <j0> <i1> <j1>        (inclusive range of top-left positions)
+//   <picId> mask <rows> <cols>              followed by rows*cols 0/1 values for positions (i,j)
+// A picture may have several entries; their union is used. Everything is clipped to the picture and 
+// turned into sorted, merged column spans per row (roiRow/roiSpan, CSR layout), which is what the search 
+// engines iterate. Pictures without entries keep roiRow == NULL and are searched everywhere. Returns false 
+// on a syntax error or unknown picture id.
+bool read_roi(const char* path,Picture* pics,int P){
+ FILE* f=fopen(path,"r"); 
+ if(!f){
+    fprintf(stderr,"Failed to open ROI file: %s\n",path);
+    return false;
+}
+ RoiInterval* v=NULL; 
+ int nv=0, cap=0;
+ bool* listed=(bool*)calloc((size_t)P+1,sizeof(bool));
+ int id;
+ char kind[16];
+ bool ok=true;
+ while(ok && fscanf(f,"%d %15s",&id,kind)==2){
+    int pi=-1;
+    for(int i=0;i<P;++i) 
+    if(pics[i].id==id){ 
+        pi=i; 
+        break; 
+    }
+    if(pi<0){
+        fprintf(stderr,"ROI for unknown picture %d\n",id);
+        ok=false;
+        break;
+    }
+    listed[pi]=true;
+    const int N=pics[pi].N;
+    if(strcmp(kind,"rect")==0){
+        int i0,j0,i1,j1;
+        if(fscanf(f,"%d %d %d %d",&i0,&j0,&i1,&j1)!=4){
+            ok=false;
+            break;
+        }
+        if(i0<0) i0=0;
+        if(j0<0) j0=0;
+        if(i1>N-1) i1=N-1;
+        if(j1>N-1) j1=N-1;
+        for(int i=i0;i<=i1 && j0<=j1 && ok;++i) 
+        ok=push_roi_interval(&v,&nv,&cap,pi,i,j0,j1);
+    }
+    else if(strcmp(kind,"mask")==0){
+        int rows,cols;
+        if(fscanf(f,"%d %d",&rows,&cols)!=2){
+            ok=false;
+            break;
+        }
+        for(int i=0;i<rows && ok;++i){
+            int runStart=-1;
+            for(int j=0;j<=cols && ok;++j){
+                int bit=0;
+                if(j<cols && fscanf(f,"%d",&bit)!=1){
+                    ok=false;
+                    break;
+                }
+                if(bit && runStart<0) 
+                runStart=j;
+                if((!bit||j==cols) && runStart>=0){
+                    int j1=j-1<N-1?j-1:N-1;
+                    if(i<N && runStart<=j1) 
+                    ok=push_roi_interval(&v,&nv,&cap,pi,i,runStart,j1);
+                    runStart=-1;
+                }
+            }
+        }
+    }
+    else ok=false;
+}
+ if(!ok) 
+ fprintf(stderr,"Failed to parse ROI file: %s\n",path);
+ fclose(f);
+ if(ok){
+    qsort(v,(size_t)nv,sizeof(RoiInterval),cmp_roi_interval);
+    int s=0;
+    for(int pi=0;pi<P && ok;++pi){
+        if(!listed[pi]) 
+        continue;
+        int e=s;
+        while(e<nv && v[e].pic==pi) 
+        ++e;
+        // A listed picture whose entries are all clipped away gets an empty ROI, not a full scan
+        Picture* pic=&pics[pi];
+        pic->roiRow=(int*)calloc((size_t)pic->N+1,sizeof(int));
+        pic->roiSpan=(int*)malloc((size_t)(e-s+1)*2*sizeof(int));
+        if(!pic->roiRow||!pic->roiSpan){
+            ok=false;
+            break;
+        }
+        int ns=0;
+        for(int t=s;t<e;++t){
+            // merge with the previous span of the same row when they overlap or touch
+            if(ns>0 && t>s && v[t].row==v[t-1].row && v[t].j0<=pic->roiSpan[2*ns-1]+1){
+                if(v[t].j1>pic->roiSpan[2*ns-1]) 
+                pic->roiSpan[2*ns-1]=v[t].j1;
+                continue;
+            }
+            pic->roiSpan[2*ns]=v[t].j0;
+            pic->roiSpan[2*ns+1]=v[t].j1;
+            pic->roiRow[v[t].row+1]++;
+            ns++;
+        }
+        for(int i=0;i<pic->N;++i) 
+        pic->roiRow[i+1]+=pic->roiRow[i];
+        s=e;
+    }
+}
+ free(listed);
+ free(v);
+ return ok;
+}
+
+// This function writes the results of the rotation/flip-invariant search. It is the same as write_output, 
+// but every found line also names the orientation of the object that matched (see orientation_name).
+void print_output_oriented(FILE* f,const MatchResult* r,int P){
+ for(int i=0;i<P;++i){ 
+    if(r[i].found) 
+    fprintf(f,"Picture %d found Object %d in Position(%d,%d) Orientation %s\n",r[i].pictureId,r[i].objectId,r[i].posI,r[i].posJ,orientation_name(r[i].orientation));
+  else fprintf(f,"Picture %d No Objects were found\n",r[i].pictureId); 
+}
+}
+
+bool write_output_oriented(const char* path,const MatchResult* r,int P){
+ FILE* f=fopen(path,"w"); 
+ if(!f){
+    fprintf(stderr,"Failed to open output file: %s\n",path);
+    return false;
+}
+ print_output_oriented(f,r,P); 
  fclose(f); 
  return true;
 }
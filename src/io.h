@@ -1,5 +1,21 @@
 #pragma once
 #include <stdbool.h>
+#include <stdio.h>
 #include "types.h"
 bool read_input(const char* path,double* t,Picture** pics,int* P,ObjectT** objs,int* M);
+bool read_picture(FILE* f,Picture* p);
 bool write_output(const char* path,const MatchResult* r,int P);
+bool write_output_all(const char* path,const MatchList* l,int P);
+bool write_output_best(const char* path,const MatchResult* r,int P);
+bool write_output_topk(const char* path,const int* pictureIds,const ScoredMatch* r,const int* counts,int K,int P);
+bool write_output_sweep(const char* path,const double* thresholds,int T,const MatchResult* r,int P);
+bool write_output_pairs(const char* path,const MatchResult* r,long long count);
+bool read_roi(const char* path,Picture* pics,int P);
+const char* run_phase_name(int p);
+const char* orientation_name(int code);
+bool write_run_report(const char* path,const RunReport* r);
+bool write_output_oriented(const char* path,const MatchResult* r,int P);
+void print_output(FILE* f,const MatchResult* r,int P);
+void print_output_all(FILE* f,const MatchList* l,int P);
+void print_output_best(FILE* f,const MatchResult* r,int P);
+void print_output_oriented(FILE* f,const MatchResult* r,int P);
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Closed-loop load generator for the daemon mode (see daemon.c). It connects to the daemon's UNIX socket,
+// sends R batches of B random N x N pictures one after another, waits for each END line and reports the
+// throughput and the client-side p50/p99/max latency, followed by the daemon's own STATS line. With
+// "--dirty D" it instead tracks one N x N picture and sends R updates of a random D x D rectangle, which
+// measures the incremental path.
+//
+//   pds_loadgen <socket> [--requests R] [--batch B] [--size N] [--seed S] [--threshold t] [--dirty D] [--quit]
+
+static double now_us(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC,&ts);
+ return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+static int cmp_double(const void* x,const void* y){
+ double a=*(const double*)x, b=*(const double*)y;
+ return (a>b)-(a<b);
+}
+
+int main(int argc,char** argv){
+ if(argc<2){
+    fprintf(stderr,"Usage: %s <socket> [--requests R] [--batch B] [--size N] [--seed S] [--threshold t] [--dirty D] [--quit]\n",argv[0]);
+    return 1;
+}
+ int requests=100, batch=1, N=64, dirty=0;
+ unsigned seed=1;
+ const char* threshold=NULL;
+ int quit=0;
+ for(int a=2;a<argc;++a){
+    if(strcmp(argv[a],"--requests")==0 && a+1<argc) requests=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--batch")==0 && a+1<argc) batch=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--size")==0 && a+1<argc) N=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--seed")==0 && a+1<argc) seed=(unsigned)atoi(argv[++a]);
+    else if(strcmp(argv[a],"--threshold")==0 && a+1<argc) threshold=argv[++a];
+    else if(strcmp(argv[a],"--dirty")==0 && a+1<argc) dirty=atoi(argv[++a]);
+    else if(strcmp(argv[a],"--quit")==0) quit=1;
+    else {
+        fprintf(stderr,"Unknown option %s\n",argv[a]);
+        return 1;
+    }
+}
+ if(requests<1||batch<1||N<1||dirty<0||dirty>N){
+    fprintf(stderr,"requests, batch and size must be positive, dirty at most size\n");
+    return 1;
+}
+ struct sockaddr_un addr;
+ memset(&addr,0,sizeof addr);
+ addr.sun_family=AF_UNIX;
+ strncpy(addr.sun_path,argv[1],sizeof addr.sun_path-1);
+ int fd=socket(AF_UNIX,SOCK_STREAM,0);
+ if(fd<0 || connect(fd,(struct sockaddr*)&addr,sizeof addr)!=0){
+    perror("connect");
+    return 1;
+}
+ FILE* in=fdopen(fd,"r");
+ FILE* out=fdopen(dup(fd),"w");
+ double* lat=(double*)malloc((size_t)requests*sizeof(double));
+ if(!in||!out||!lat){
+    fprintf(stderr,"out of memory\n");
+    return 1;
+}
+ srand(seed);
+ char line[512];
+ long long found=0;
+ if(dirty>0){
+    // The tracked picture; its answer is not part of the measurement
+    batch=1;
+    fprintf(out,"TRACK 1 %s\n1 %d\n",threshold?threshold:"",N);
+    for(int t=0;t<N*N;++t)
+    fprintf(out,"%d ",1+rand()%255);
+    fputc('\n',out);
+    fflush(out);
+    while(fgets(line,sizeof line,in) && strncmp(line,"END",3)!=0)
+    if(strncmp(line,"ERR",3)==0){
+        fprintf(stderr,"daemon: %s",line);
+        return 1;
+    }
+}
+ const double start=now_us();
+ for(int r=0;r<requests;++r){
+    // Pixels are kept positive, the score divides by them
+    const double t0=now_us();
+    if(dirty>0){
+        fprintf(out,"UPDATE 1 1 %s\n%d %d %d %d\n",threshold?threshold:"",rand()%(N-dirty+1),rand()%(N-dirty+1),dirty,dirty);
+        for(int t=0;t<dirty*dirty;++t)
+        fprintf(out,"%d ",1+rand()%255);
+        fputc('\n',out);
+    }
+    else if(threshold) fprintf(out,"BATCH %d %s\n",batch,threshold);
+    else fprintf(out,"BATCH %d\n",batch);
+    for(int b=0;b<batch && dirty==0;++b){
+        fprintf(out,"%d %d\n",r*batch+b+1,N);
+        for(int i=0;i<N;++i){
+            for(int j=0;j<N;++j)
+            fprintf(out,"%d ",1+rand()%255);
+            fputc('\n',out);
+        }
+    }
+    fflush(out);
+    int done=0;
+    while(!done && fgets(line,sizeof line,in)){
+        if(strncmp(line,"END",3)==0) done=1;
+        else if(strncmp(line,"ERR",3)==0){
+            fprintf(stderr,"daemon: %s",line);
+            return 1;
+        }
+        else if(strstr(line," found ")) found++;
+    }
+    if(!done){
+        fprintf(stderr,"daemon closed the connection\n");
+        return 1;
+    }
+    lat[r]=now_us()-t0;
+}
+ const double elapsed=(now_us()-start)/1e6;
+ qsort(lat,(size_t)requests,sizeof(double),cmp_double);
+ printf("requests %d batch %d size %d: %.3f s, %.1f req/s, %.1f pictures/s, %lld found\n",
+        requests,batch,N,elapsed,requests/elapsed,(double)requests*batch/elapsed,found);
+ printf("client latency ms: p50 %.3f p99 %.3f max %.3f\n",
+        lat[(requests-1)/2]/1e3,lat[(int)((requests-1)*0.99)]/1e3,lat[requests-1]/1e3);
+ fputs(quit?"STATS\nQUIT\n":"STATS\n",out);
+ fflush(out);
+ if(fgets(line,sizeof line,in))
+ printf("server %s",line);
+ free(lat);
+ fclose(out);
+ fclose(in);
+ return 0;
+}
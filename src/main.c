@@ -1,10 +1,17 @@
 #include <mpi.h>
 #include <omp.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "types.h"
 #include "io.h"
 #include "compute.h"
+#include "pds.h"
+#include "daemon.h"
+#include "cache.h"
+#include "dedup.h"
+#include "trace.h"
 #ifdef USE_CUDA
 #include "cuda_match.h"
 #endif
@@ -23,6 +30,962 @@ static void bcast_double(double* v){
   MPI_Bcast(v,1,MPI_DOUBLE,0,MPI_COMM_WORLD);
 }
 
+// Command line options that follow the input and output paths.
+typedef struct{
+    SearchMode mode;
+    int topK;
+    double* thresholds;
+    int nThresholds;
+    const char* roiPath;
+    bool symmetric;
+    int stride;
+    double refineFactor;
+    bool recall;
+    int sample;
+    bool sampleProb;
+    double confidence;
+    const char* daemon;
+    bool sequence;
+    int radius;
+    const char* cachePath;
+    long long cacheLimit;
+    bool dedup;
+    double cluster;
+    bool trie;
+    const char* tracePath;
+    int traceSample;
+} 
+RunOptions;
+
+// This helper sends the region of interest of one picture from rank 0 to all ranks. Rank 0 passes the 
+// picture it read (src) and shares its arrays; other ranks allocate their own copy. Pictures without an 
+// ROI only cost one broadcast int.
+static void bcast_roi(Picture* dst,const Picture* src,int rank){
+  int spans=0; 
+  if(rank==0) 
+  spans=src->roiRow?src->roiRow[src->N]:-1; 
+  bcast_int(&spans); 
+  if(spans<0){ 
+    dst->roiRow=NULL; 
+    dst->roiSpan=NULL; 
+    return; 
+  } 
+  if(rank==0){ 
+    dst->roiRow=src->roiRow; 
+    dst->roiSpan=src->roiSpan; 
+  } else { 
+    dst->roiRow=(int*)malloc(((size_t)dst->N+1)*sizeof(int)); 
+    dst->roiSpan=(int*)malloc(((size_t)spans*2+1)*sizeof(int)); 
+  } 
+  MPI_Bcast(dst->roiRow,dst->N+1,MPI_INT,0,MPI_COMM_WORLD); 
+  MPI_Bcast(dst->roiSpan,spans*2,MPI_INT,0,MPI_COMM_WORLD); 
+}
+
+// This helper sends the mask of one object from rank 0 to all ranks, in the same way as bcast_roi: the 
+// number of active pixels first (-1 for an unmasked object), then the compacted row offsets, columns 
+// and values.
+static void bcast_mask(ObjectT* dst,const ObjectT* src,int rank){
+  int active=0; 
+  if(rank==0) 
+  active=src->maskRow?src->maskRow[src->n]:-1; 
+  bcast_int(&active); 
+  if(active<0){ 
+    dst->maskRow=NULL; 
+    dst->maskCol=NULL; 
+    dst->maskVal=NULL; 
+    return; 
+  } 
+  if(rank==0){ 
+    dst->maskRow=src->maskRow; 
+    dst->maskCol=src->maskCol; 
+    dst->maskVal=src->maskVal; 
+  } else { 
+    dst->maskRow=(int*)malloc(((size_t)dst->n+1)*sizeof(int)); 
+    dst->maskCol=(int*)malloc(((size_t)active+1)*sizeof(int)); 
+    dst->maskVal=(int*)malloc(((size_t)active+1)*sizeof(int)); 
+  } 
+  MPI_Bcast(dst->maskRow,dst->n+1,MPI_INT,0,MPI_COMM_WORLD); 
+  MPI_Bcast(dst->maskCol,active,MPI_INT,0,MPI_COMM_WORLD); 
+  MPI_Bcast(dst->maskVal,active,MPI_INT,0,MPI_COMM_WORLD); 
+}
+
+// This helper parses the optional flags that follow the input and output paths: "--mode first|all|best|topk|matrix" 
+// selects between the classic first-match search, the all-matches search, the best-match search, the 
+// top-K search and the picture x object match matrix, "--k K" sets K for the top-K search, and "--thresholds t1,t2,..." switches to a threshold 
+// sweep that replaces the threshold from the input file (a first-match sweep, so only "--mode first" may accompany it). "--roi <file>" restricts the search of the listed 
+// pictures to regions of interest (see read_roi). "--symmetric" makes the first-match search invariant to 
+// the 8 rotations/mirrors of the objects. "--stride s" turns the first/all searches into the coarse-grid 
+// search with local refinement (find_all_matches_strided), "--refine-factor f" sets how far above the 
+// threshold a grid point may score and still be refined, and "--recall" also runs the exhaustive search 
+// and reports the recall of the strided one. "--sample S" adds the pixel-sampling prefilter to the 
+// first/all searches, "--sample-mode exact|prob" picks its variant and "--confidence z" sets z for the 
+// probabilistic one. "--daemon <socket|->" keeps the objects loaded and answers picture batches instead of 
+// searching the input pictures (see daemon.c). "--sequence" treats the pictures as consecutive frames and 
+// probes around the previous frame's match first, within "--radius R" rings. "--cache <dir>" looks the 
+// first/best results up in a persistent result cache (cache.c) limited to "--cache-size MB". "--no-dedup" 
+// searches repeated pictures and objects once per copy instead of once (dedup.c). "--cluster R" groups 
+// near-duplicate objects around medoids within mean pixel difference R and prunes members per window. "--trie" 
+// scores objects that share their first rows through the object trie (find_match_trie). "--trace <file>" 
+// records a Chrome trace of the run (trace.c), keeping one in "--trace-sample N" row tasks. Every rank parses the 
+// same argv, so no broadcast is needed. Returns false on a bad flag.
+static bool parse_options(int argc,char** argv,RunOptions* opt){
+ opt->mode=SEARCH_FIRST;
+ opt->topK=10;
+ opt->thresholds=NULL;
+ opt->nThresholds=0;
+ opt->roiPath=NULL;
+ opt->symmetric=false;
+ opt->stride=1;
+ opt->refineFactor=2.0;
+ opt->recall=false;
+ opt->sample=0;
+ opt->sampleProb=false;
+ opt->confidence=3.0;
+ opt->daemon=NULL;
+ opt->sequence=false;
+ opt->radius=16;
+ opt->cachePath=NULL;
+ opt->cacheLimit=64LL<<20;
+ opt->dedup=true;
+ opt->cluster=0.0;
+ opt->trie=false;
+ opt->tracePath=NULL;
+ opt->traceSample=1;
+ for(int a=3;a<argc;++a){
+    if(strcmp(argv[a],"--mode")==0 && a+1<argc){
+        const char* m=argv[++a];
+        if(strcmp(m,"first")==0) opt->mode=SEARCH_FIRST;
+        else if(strcmp(m,"all")==0) opt->mode=SEARCH_ALL;
+        else if(strcmp(m,"best")==0) opt->mode=SEARCH_BEST;
+        else if(strcmp(m,"topk")==0) opt->mode=SEARCH_TOPK;
+        else if(strcmp(m,"matrix")==0) opt->mode=SEARCH_MATRIX;
+        else return false;
+    }
+    else if(strcmp(argv[a],"--k")==0 && a+1<argc){
+        opt->topK=atoi(argv[++a]);
+        if(opt->topK<1) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--stride")==0 && a+1<argc){
+        opt->stride=atoi(argv[++a]);
+        if(opt->stride<1) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--refine-factor")==0 && a+1<argc){
+        opt->refineFactor=atof(argv[++a]);
+        if(opt->refineFactor<1.0) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--recall")==0){
+        opt->recall=true;
+    }
+    else if(strcmp(argv[a],"--sample")==0 && a+1<argc){
+        opt->sample=atoi(argv[++a]);
+        if(opt->sample<1) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--sample-mode")==0 && a+1<argc){
+        const char* m=argv[++a];
+        if(strcmp(m,"exact")==0) opt->sampleProb=false;
+        else if(strcmp(m,"prob")==0) opt->sampleProb=true;
+        else return false;
+    }
+    else if(strcmp(argv[a],"--confidence")==0 && a+1<argc){
+        opt->confidence=atof(argv[++a]);
+        if(opt->confidence<0.0) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--sequence")==0){
+        opt->sequence=true;
+    }
+    else if(strcmp(argv[a],"--radius")==0 && a+1<argc){
+        opt->radius=atoi(argv[++a]);
+        if(opt->radius<0) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--cluster")==0 && a+1<argc){
+        opt->cluster=atof(argv[++a]);
+        if(opt->cluster<=0.0) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--trie")==0){
+        opt->trie=true;
+    }
+    else if(strcmp(argv[a],"--trace")==0 && a+1<argc){
+        opt->tracePath=argv[++a];
+    }
+    else if(strcmp(argv[a],"--trace-sample")==0 && a+1<argc){
+        opt->traceSample=atoi(argv[++a]);
+        if(opt->traceSample<1) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--no-dedup")==0){
+        opt->dedup=false;
+    }
+    else if(strcmp(argv[a],"--cache")==0 && a+1<argc){
+        opt->cachePath=argv[++a];
+    }
+    else if(strcmp(argv[a],"--cache-size")==0 && a+1<argc){
+        opt->cacheLimit=(long long)(atof(argv[++a])*(1<<20));
+        if(opt->cacheLimit<0) 
+        return false;
+    }
+    else if(strcmp(argv[a],"--daemon")==0 && a+1<argc){
+        opt->daemon=argv[++a];
+    }
+    else if(strcmp(argv[a],"--symmetric")==0){
+        opt->symmetric=true;
+    }
+    else if(strcmp(argv[a],"--roi")==0 && a+1<argc){
+        opt->roiPath=argv[++a];
+    }
+    else if(strcmp(argv[a],"--thresholds")==0 && a+1<argc){
+        const char* list=argv[++a];
+        int cap=1;
+        for(const char* c=list;*c;++c) 
+        if(*c==',') cap++;
+        free(opt->thresholds);
+        opt->thresholds=(double*)malloc((size_t)cap*sizeof(double));
+        opt->nThresholds=0;
+        const char* c=list;
+        while(*c){
+            char* end;
+            double t=strtod(c,&end);
+            if(end==c) 
+            return false;
+            opt->thresholds[opt->nThresholds++]=t;
+            c=end;
+            if(*c==',') 
+            ++c;
+            else if(*c) 
+            return false;
+        }
+        if(opt->nThresholds==0) 
+        return false;
+    }
+    else return false;
+}
+ // The sweep is a multi-threshold first-match search; any other explicit mode contradicts it, in either order
+ if(opt->nThresholds>0){
+    if(opt->mode!=SEARCH_FIRST) 
+    return false;
+    opt->mode=SEARCH_SWEEP;
+}
+ // The symmetric kernel only exists for the first-match search, the strided one and the sampling 
+ // prefilter for the exhaustive first/all searches
+ if(opt->symmetric && (opt->mode!=SEARCH_FIRST || opt->stride>1)) 
+ return false;
+ if(opt->sample>0 && (opt->symmetric || opt->stride>1 || (opt->mode!=SEARCH_FIRST && opt->mode!=SEARCH_ALL))) 
+ return false;
+ // The similarity pruning lives in the exhaustive first/all engines
+ if(opt->cluster>0 && (opt->symmetric || opt->stride>1 || (opt->mode!=SEARCH_FIRST && opt->mode!=SEARCH_ALL))) 
+ return false;
+ // The prefix-sharing search is an engine of its own, without the per-object prefilters
+ if(opt->trie && (opt->symmetric || opt->stride>1 || opt->sample>0 || opt->cluster>0 || (opt->mode!=SEARCH_FIRST && opt->mode!=SEARCH_ALL))) 
+ return false;
+ // The sequence probe is a first-match search over the plain objects
+ if(opt->sequence && (opt->mode!=SEARCH_FIRST || opt->symmetric || opt->stride>1 || opt->daemon)) 
+ return false;
+ // The tracer writes its file at the end of a batch run
+ if(opt->tracePath && opt->daemon) 
+ return false;
+ // The result cache stores one MatchResult per picture, i.e. the first/best searches
+ if(opt->cachePath && ((opt->mode!=SEARCH_FIRST && opt->mode!=SEARCH_BEST) || opt->daemon)) 
+ return false;
+ // The daemon answers first/best/all batches; ROIs are per input picture and don't apply to it
+ if(opt->daemon && (opt->stride>1 || opt->roiPath || (opt->mode!=SEARCH_FIRST && opt->mode!=SEARCH_BEST && opt->mode!=SEARCH_ALL))) 
+ return false;
+ return opt->stride==1 || opt->mode==SEARCH_FIRST || opt->mode==SEARCH_ALL;
+}
+
+// This helper measures the recall of the strided search on one picture: it runs the exhaustive 
+// all-matches search as well and adds (strided hits, exhaustive hits, pictures found strided, pictures 
+// found exhaustively) to 'acc'. The strided hits are always a subset of the exhaustive ones.
+static void accumulate_recall(PdsContext* ctx,const Picture* pic,double threshold,const MatchList* approx,long long* acc){
+ MatchList exact={0,0,0,NULL};
+ if(pds_search_all(ctx,pic,threshold,&exact)<0) 
+ return;
+ acc[0]+=approx->count;
+ acc[1]+=exact.count;
+ acc[2]+=approx->count>0;
+ acc[3]+=exact.count>0;
+ match_list_free(&exact);
+}
+
+// Sums the recall counters of all ranks and prints them on rank 0.
+static void report_recall(long long* acc,int rank,int stride,double factor){
+ long long tot[4]={0,0,0,0};
+ MPI_Reduce(acc,tot,4,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD);
+ if(rank==0) 
+ fprintf(stderr,"[rank 0] stride %d factor %.2f recall: hits %lld/%lld (%.2f%%), pictures %lld/%lld\n",
+  stride,factor,tot[0],tot[1],tot[1]?100.0*tot[0]/tot[1]:100.0,tot[2],tot[3]);
+}
+
+// Wall-clock time of every run phase on this rank. phase_enter closes the running phase and starts the 
+// given one (-1 stops timing), so the phases partition the run from reading the input to the last write. 
+// Waiting in a collective counts towards the phase that waits: a rank idle in the broadcast while rank 0 
+// parses shows up as distribute time, and rank 0 waiting for slow workers as gather time.
+static double g_phaseTime[PHASE_COUNT];
+static int g_phase=-1;
+static double g_phaseStart=0.0;
+static double g_phaseTrace=-1.0;
+
+static void phase_enter(int phase){
+ const double now=MPI_Wtime();
+ if(g_phase>=0){ 
+  g_phaseTime[g_phase]+=now-g_phaseStart;
+  trace_end(TRACE_PHASE,g_phase,g_phaseTrace);
+ }
+ g_phase=phase;
+ g_phaseStart=now;
+ g_phaseTrace=phase>=0?trace_begin(TRACE_PHASE,phase):-1.0;
+}
+
+#ifdef PDS_COUNTERS
+static int cmp_hot_picture(const void* x,const void* y){
+ const long long a=((const HotPicture*)x)->pictureId, b=((const HotPicture*)y)->pictureId;
+ return (a>b)-(a<b);
+}
+
+// Counters build: sums the hot-path counters of all ranks into 'total' and the per-object records into 
+// 'objects' (M entries, by object index) at rank 0, and gathers the per-picture records there, sorted by 
+// picture id. Returns the gathered records on rank 0 (count in *pictureCount), NULL elsewhere.
+static HotPicture* gather_hot_counters(int rank,int size,int M,HotCounters* total,HotCounters* objects,int* pictureCount){
+ HotCounters t;
+ const HotCounters* objs;
+ const HotPicture* pics;
+ int no=0, np=0;
+ hot_counters(&t,&objs,&no,&pics,&np);
+ HotCounters* loc=(HotCounters*)calloc((size_t)M+1,sizeof(HotCounters));
+ if(loc && objs) 
+ memcpy(loc,objs,(size_t)(no<M?no:M)*sizeof(HotCounters));
+ MPI_Reduce(&t,total,HOT_FIELDS,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD);
+ MPI_Reduce(loc,objects,M*HOT_FIELDS,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD);
+ free(loc);
+ // Variable-length picture records: counts first, then one gatherv of HOT_FIELDS+1 values per record
+ const int rec=HOT_FIELDS+1;
+ int* counts=rank==0?(int*)malloc((size_t)size*sizeof(int)):NULL;
+ int* displs=rank==0?(int*)malloc((size_t)size*sizeof(int)):NULL;
+ const int mine=np*rec;
+ MPI_Gather(&mine,1,MPI_INT,counts,1,MPI_INT,0,MPI_COMM_WORLD);
+ HotPicture* all=NULL;
+ int n=0;
+ if(rank==0){
+    for(int q=0;q<size;++q){
+        displs[q]=n;
+        n+=counts[q];
+    }
+    all=(HotPicture*)malloc(((size_t)n/rec+1)*sizeof(HotPicture));
+}
+ MPI_Gatherv(pics,mine,MPI_LONG_LONG,all,counts,displs,MPI_LONG_LONG,0,MPI_COMM_WORLD);
+ free(counts);
+ free(displs);
+ if(rank==0){
+    *pictureCount=n/rec;
+    qsort(all,(size_t)*pictureCount,sizeof(HotPicture),cmp_hot_picture);
+}
+ return all;
+}
+#endif
+
+// This function reduces the phase times of all ranks to min/avg/max at rank 0, gathers the per-rank 
+// values, and writes them as JSON to "<output>.timing.json" (see write_run_report). A counters build 
+// adds the hot-path counters: the total, one record per object and one per picture.
+static void report_phases(int rank,int size,const char* outPath,const ObjectT* objs,int M){
+ enum{ C=PHASE_COUNT+1 };
+ double loc[C], mn[C], mx[C], sum[C];
+ loc[PHASE_COUNT]=0.0;
+ for(int p=0;p<PHASE_COUNT;++p){
+    loc[p]=g_phaseTime[p];
+    loc[PHASE_COUNT]+=loc[p];
+}
+ MPI_Reduce(loc,mn,C,MPI_DOUBLE,MPI_MIN,0,MPI_COMM_WORLD);
+ MPI_Reduce(loc,mx,C,MPI_DOUBLE,MPI_MAX,0,MPI_COMM_WORLD);
+ MPI_Reduce(loc,sum,C,MPI_DOUBLE,MPI_SUM,0,MPI_COMM_WORLD);
+ double* per=rank==0?(double*)malloc((size_t)size*C*sizeof(double)):NULL;
+ MPI_Gather(loc,C,MPI_DOUBLE,per,C,MPI_DOUBLE,0,MPI_COMM_WORLD);
+ RunReport r;
+ memset(&r,0,sizeof r);
+ int* ids=NULL;
+#ifdef PDS_COUNTERS
+ HotCounters total;
+ HotCounters* objects=(HotCounters*)calloc((size_t)M+1,sizeof(HotCounters));
+ HotPicture* pictures=gather_hot_counters(rank,size,M,&total,objects,&r.pictureCount);
+ ids=(int*)malloc(((size_t)M+1)*sizeof(int));
+ if(ids){
+    for(int k=0;k<M;++k) 
+    ids[k]=objs[k].id;
+    r.total=&total;
+    r.objects=objects;
+    r.objectIds=ids;
+    r.objectCount=M;
+    r.pictures=pictures;
+}
+#else
+ (void)objs;
+ (void)M;
+#endif
+ if(rank==0 && per){
+    r.ranks=size;
+    r.perRank=per;
+    for(int p=0;p<C;++p){
+        r.min[p]=mn[p];
+        r.avg[p]=sum[p]/size;
+        r.max[p]=mx[p];
+    }
+    char path[4096];
+    snprintf(path,sizeof path,"%s.timing.json",outPath);
+    if(write_run_report(path,&r)) 
+    fprintf(stderr,"[rank 0] phase timings written to %s\n",path);
+}
+#ifdef PDS_COUNTERS
+ free(objects);
+ free(pictures);
+#endif
+ free(ids);
+ free(per);
+}
+
+// This function merges the trace events of all ranks at rank 0 and writes them as one Chrome trace. Every 
+// rank flattens its rings (trace_collect) and the events travel in one gatherv as a contiguous datatype of 
+// sizeof(TraceEvent) bytes, so the counts and displacements are events, not bytes. The gatherv counts are 
+// ints, so rank 0 caps the merged trace at INT_MAX events: it sends every rank back how many of its events 
+// still fit, and the rest are reported with the dropped ones.
+static void write_trace(int rank,int size,const char* path){
+ TraceEvent* ev=NULL;
+ long long dropped=0;
+ int n=trace_collect(rank,&ev,&dropped);
+ if(n<0){ 
+  fprintf(stderr,"[rank %d] out of memory collecting the trace\n",rank); 
+  n=0; 
+ }
+ trace_stop();
+ MPI_Datatype eventType;
+ MPI_Type_contiguous((int)sizeof(TraceEvent),MPI_BYTE,&eventType);
+ MPI_Type_commit(&eventType);
+ int* counts=rank==0?(int*)malloc((size_t)size*sizeof(int)):NULL;
+ int* displs=rank==0?(int*)malloc((size_t)size*sizeof(int)):NULL;
+ if(rank==0 && (!counts||!displs)){ 
+  fprintf(stderr,"[rank 0] out of memory gathering the trace\n"); 
+  MPI_Abort(MPI_COMM_WORLD,3); 
+ }
+ MPI_Gather(&n,1,MPI_INT,counts,1,MPI_INT,0,MPI_COMM_WORLD);
+ long long total=0;
+ if(rank==0){ 
+  for(int q=0;q<size;++q){ 
+    if(counts[q]>INT_MAX-total) 
+    counts[q]=(int)(INT_MAX-total); 
+    displs[q]=(int)total; 
+    total+=counts[q]; 
+  } 
+ }
+ int send=0;
+ MPI_Scatter(counts,1,MPI_INT,&send,1,MPI_INT,0,MPI_COMM_WORLD);
+ dropped+=n-send;
+ long long lost=0;
+ MPI_Reduce(&dropped,&lost,1,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD);
+ TraceEvent* all=rank==0?(TraceEvent*)malloc(((size_t)total+1)*sizeof(TraceEvent)):NULL;
+ if(rank==0 && !all){ 
+  fprintf(stderr,"[rank 0] out of memory gathering the trace\n"); 
+  MPI_Abort(MPI_COMM_WORLD,3); 
+ }
+ MPI_Gatherv(ev,send,eventType,all,counts,displs,eventType,0,MPI_COMM_WORLD);
+ MPI_Type_free(&eventType);
+ if(rank==0){ 
+  if(trace_write_json(path,all,(int)total,size)) 
+  fprintf(stderr,"[rank 0] trace: %lld events written to %s (%lld dropped: full rings, threads without a ring or over the gather limit)\n",total,path,lost); 
+ }
+ free(all);
+ free(counts);
+ free(displs);
+ free(ev);
+}
+
+// Sums the skip counters of the search engines over all ranks and prints them on rank 0: windows answered 
+// from an identical neighbour (window_repeat_stats), (picture, object) pairs ruled out by the pair 
+// prefilter (pair_filter_stats), cluster member windows ruled out by their medoid (cluster_prune_stats) 
+// and the rows scored and subtrees cut by the prefix-sharing search (trie_search_stats).
+static void report_search_stats(int rank){
+ long long loc[8], tot[8]={0,0,0,0,0,0,0,0};
+ window_repeat_stats(&loc[0],&loc[1]);
+ pair_filter_stats(&loc[2],&loc[3]);
+ cluster_prune_stats(&loc[4],&loc[5]);
+ trie_search_stats(&loc[6],&loc[7]);
+ MPI_Reduce(loc,tot,8,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD);
+ if(rank==0 && tot[1]>0) 
+ fprintf(stderr,"[rank 0] repeated windows: %lld of %lld skipped (%.2f%%)\n",tot[0],tot[1],100.0*tot[0]/tot[1]);
+ if(rank==0 && tot[3]>0) 
+ fprintf(stderr,"[rank 0] pair prefilter: %lld of %lld picture/object pairs skipped\n",tot[2],tot[3]);
+ if(rank==0 && tot[5]>0) 
+ fprintf(stderr,"[rank 0] cluster pruning: %lld of %lld member windows skipped (%.2f%%)\n",tot[4],tot[5],100.0*tot[4]/tot[5]);
+ if(rank==0 && tot[6]>0) 
+ fprintf(stderr,"[rank 0] object trie: %lld node rows scored, %lld subtrees cut at the threshold\n",tot[6],tot[7]);
+}
+
+// This function runs the all-matches mode on this rank and collects the results at rank 0. Each rank 
+// searches its round-robin share of pictures (strided if requested), keeping one MatchList per picture. Because the number of 
+// hits differs per picture, the lists are sent as variable-length records: for every picture a worker 
+// first sends the hit count and then the hits themselves straight from the list memory (three ints per 
+// hit, no repacking). Rank 0 knows the round-robin order, so it can place every list at its picture index 
+// without searching by id, and finally writes the compact all-matches output.
+static void run_all_mode(const Picture* pics,int P,PdsContext* ctx,double threshold,const RunOptions* opt,const Dedup* dd,int rank,int size,const char* outPath){
+ int local_cap=(P+size-1)/size; 
+ MatchList* local=(MatchList*)calloc((size_t)local_cap+1,sizeof(MatchList)); 
+ if(!local){
+    fprintf(stderr,"[rank %d] out of memory for the match lists\n",rank);
+    MPI_Abort(MPI_COMM_WORLD,3);
+}
+ int lc=0;
+ long long acc[4]={0,0,0,0};
+ for(int idx=rank; idx<P; idx+=size){
+    const int found=opt->stride>1?pds_search_all_strided(ctx,&pics[idx],threshold,opt->stride,opt->refineFactor,&local[lc])
+                                  :pds_search_all(ctx,&pics[idx],threshold,&local[lc]);
+    if(found<0){
+        fprintf(stderr,"[rank %d] out of memory collecting matches for picture %d\n",rank,pics[idx].id);
+        MPI_Abort(MPI_COMM_WORLD,3);
+    }
+    if(opt->recall) 
+    accumulate_recall(ctx,&pics[idx],threshold,&local[lc],acc);
+    lc++;
+}
+ phase_enter(PHASE_GATHER);
+ report_search_stats(rank);
+ if(opt->recall) 
+ report_recall(acc,rank,opt->stride,opt->refineFactor);
+ if(rank==0){
+  MatchList* all=(MatchList*)calloc((size_t)P+1,sizeof(MatchList));
+  if(!all){
+    fprintf(stderr,"[rank 0] out of memory for the match lists\n");
+    MPI_Abort(MPI_COMM_WORLD,3);
+  }
+  int k=0;
+  for(int idx=0; idx<P; idx+=size) 
+  all[idx]=local[k++];
+  for(int src=1; src<size; ++src){
+    for(int idx=src; idx<P; idx+=size){
+        int count=0;
+        MPI_Recv(&count,1,MPI_INT,src,102,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+        all[idx].pictureId=pics[idx].id;
+        all[idx].count=count;
+        all[idx].cap=count;
+        all[idx].hits=(MatchHit*)malloc((size_t)(count>0?count:1)*sizeof(MatchHit));
+        if(!all[idx].hits){
+            fprintf(stderr,"[rank 0] out of memory receiving matches for picture %d\n",pics[idx].id);
+            MPI_Abort(MPI_COMM_WORLD,3);
+        }
+        if(count>0) 
+        MPI_Recv(all[idx].hits,count*3,MPI_INT,src,103,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    }
+  }
+  if(dd){ 
+    MatchList* full=dedup_expand_lists(dd,all); 
+    if(!full){ 
+        fprintf(stderr,"[rank 0] out of memory expanding duplicate matches\n"); 
+        MPI_Abort(MPI_COMM_WORLD,3); 
+    } 
+    for(int idx=0; idx<P; ++idx) 
+    match_list_free(&all[idx]); 
+    free(all); 
+    all=full; 
+    P=dd->P; 
+  }
+  phase_enter(PHASE_WRITE);
+  fprintf(stderr, "[rank %d] writing results to %s\n", rank, outPath);
+  write_output_all(outPath,all,P);
+  for(int idx=0; idx<P; ++idx) 
+  match_list_free(&all[idx]);
+  free(all);
+ } else {
+  for(int t=0;t<lc;++t){
+    MPI_Send(&local[t].count,1,MPI_INT,0,102,MPI_COMM_WORLD);
+    if(local[t].count>0) 
+    MPI_Send(local[t].hits,local[t].count*3,MPI_INT,0,103,MPI_COMM_WORLD);
+    match_list_free(&local[t]);
+  }
+ }
+ free(local);
+}
+
+// This function runs the top-K mode on this rank and collects the results at rank 0. Every picture is 
+// owned by exactly one rank, so the per-picture merge of the thread heaps already happened inside 
+// pds_search_topk and the cross-rank step only has to move at most K candidates per picture. 
+// Like the all-matches mode, each picture is sent as a count followed by the records; positions travel 
+// as ints and scores as doubles.
+static void run_topk_mode(const Picture* pics,int P,PdsContext* ctx,double threshold,int K,const Dedup* dd,int rank,int size,const char* outPath){
+ int local_cap=(P+size-1)/size; 
+ ScoredMatch* local=(ScoredMatch*)malloc(((size_t)local_cap+1)*(size_t)K*sizeof(ScoredMatch)); 
+ int* lcount=(int*)calloc((size_t)local_cap+1,sizeof(int)); 
+ int* ibuf=(int*)malloc((size_t)K*3*sizeof(int)); 
+ double* dbuf=(double*)malloc((size_t)K*sizeof(double)); 
+ if(!local||!lcount||!ibuf||!dbuf){
+    fprintf(stderr,"[rank %d] out of memory for top-%d results\n",rank,K);
+    MPI_Abort(MPI_COMM_WORLD,3);
+}
+ int lc=0;
+ for(int idx=rank; idx<P; idx+=size){
+    lcount[lc]=pds_search_topk(ctx,&pics[idx],threshold,K,&local[(size_t)lc*K]);
+    if(lcount[lc]<0){
+        fprintf(stderr,"[rank %d] out of memory collecting top-%d for picture %d\n",rank,K,pics[idx].id);
+        MPI_Abort(MPI_COMM_WORLD,3);
+    }
+    lc++;
+}
+ phase_enter(PHASE_GATHER);
+ report_search_stats(rank);
+ if(rank==0){
+  ScoredMatch* all=(ScoredMatch*)malloc(((size_t)P+1)*(size_t)K*sizeof(ScoredMatch));
+  int* counts=(int*)calloc((size_t)P+1,sizeof(int));
+  int* ids=(int*)malloc(((size_t)P+1)*sizeof(int));
+  if(!all||!counts||!ids){
+    fprintf(stderr,"[rank 0] out of memory for top-%d results\n",K);
+    MPI_Abort(MPI_COMM_WORLD,3);
+  }
+  for(int idx=0; idx<P; ++idx) 
+  ids[idx]=pics[idx].id;
+  int k=0;
+  for(int idx=0; idx<P; idx+=size,++k){
+    counts[idx]=lcount[k];
+    for(int e=0;e<lcount[k];++e) 
+    all[(size_t)idx*K+e]=local[(size_t)k*K+e];
+  }
+  for(int src=1; src<size; ++src){
+    for(int idx=src; idx<P; idx+=size){
+        int count=0;
+        MPI_Recv(&count,1,MPI_INT,src,105,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+        if(count>0){
+            MPI_Recv(ibuf,count*3,MPI_INT,src,106,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+            MPI_Recv(dbuf,count,MPI_DOUBLE,src,107,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+        }
+        counts[idx]=count;
+        for(int e=0;e<count;++e){
+            ScoredMatch* m=&all[(size_t)idx*K+e];
+            m->objectId=ibuf[e*3+0]; 
+            m->posI=ibuf[e*3+1]; 
+            m->posJ=ibuf[e*3+2]; 
+            m->score=dbuf[e];
+        }
+    }
+  }
+  // Repeated pictures share the candidates of their first copy (objects are not merged in this mode)
+  if(dd){ 
+    ScoredMatch* fall=(ScoredMatch*)malloc(((size_t)dd->P+1)*(size_t)K*sizeof(ScoredMatch)); 
+    int* fcounts=(int*)malloc(((size_t)dd->P+1)*sizeof(int)); 
+    int* fids=(int*)malloc(((size_t)dd->P+1)*sizeof(int)); 
+    if(!fall||!fcounts||!fids){ 
+        fprintf(stderr,"[rank 0] out of memory for top-%d results\n",K); 
+        MPI_Abort(MPI_COMM_WORLD,3); 
+    } 
+    for(int i=0;i<dd->P;++i){ 
+        const int u=dd->picOf[i]; 
+        fids[i]=dd->picId[i]; 
+        fcounts[i]=counts[u]; 
+        memcpy(&fall[(size_t)i*K],&all[(size_t)u*K],(size_t)counts[u]*sizeof(ScoredMatch)); 
+    } 
+    free(all); 
+    free(counts); 
+    free(ids); 
+    all=fall; 
+    counts=fcounts; 
+    ids=fids; 
+    P=dd->P; 
+  }
+  phase_enter(PHASE_WRITE);
+  fprintf(stderr, "[rank %d] writing results to %s\n", rank, outPath);
+  write_output_topk(outPath,ids,all,counts,K,P);
+  free(all);
+  free(counts);
+  free(ids);
+ } else {
+  for(int t=0;t<lc;++t){
+    const ScoredMatch* m=&local[(size_t)t*K];
+    MPI_Send(&lcount[t],1,MPI_INT,0,105,MPI_COMM_WORLD);
+    if(lcount[t]==0) 
+    continue;
+    for(int e=0;e<lcount[t];++e){
+        ibuf[e*3+0]=m[e].objectId; 
+        ibuf[e*3+1]=m[e].posI; 
+        ibuf[e*3+2]=m[e].posJ; 
+        dbuf[e]=m[e].score;
+    }
+    MPI_Send(ibuf,lcount[t]*3,MPI_INT,0,106,MPI_COMM_WORLD);
+    MPI_Send(dbuf,lcount[t],MPI_DOUBLE,0,107,MPI_COMM_WORLD);
+  }
+ }
+ free(local);
+ free(lcount);
+ free(ibuf);
+ free(dbuf);
+}
+
+// This function runs the threshold sweep on this rank and collects the results at rank 0. Each picture 
+// produces one MatchResult per threshold; workers send them in round-robin picture order as five ints 
+// per result, so rank 0 can put them straight into the [threshold][picture] table that the writer expects.
+static void run_sweep_mode(const Picture* pics,int P,PdsContext* ctx,const double* thr,int T,const Dedup* dd,int rank,int size,const char* outPath){
+ int local_cap=(P+size-1)/size; 
+ MatchResult* local=(MatchResult*)malloc(((size_t)local_cap+1)*(size_t)T*sizeof(MatchResult)); 
+ if(!local){
+    fprintf(stderr,"[rank %d] out of memory for the sweep results\n",rank);
+    MPI_Abort(MPI_COMM_WORLD,3);
+}
+ int lc=0;
+ for(int idx=rank; idx<P; idx+=size,++lc) 
+ pds_search_sweep(ctx,&pics[idx],thr,T,&local[(size_t)lc*T]);
+ phase_enter(PHASE_GATHER);
+ report_search_stats(rank);
+ if(rank==0){
+  MatchResult* all=(MatchResult*)malloc(((size_t)P+1)*(size_t)T*sizeof(MatchResult));
+  int* buf=(int*)malloc(((size_t)local_cap+1)*(size_t)T*5*sizeof(int));
+  if(!all||!buf){
+    fprintf(stderr,"[rank 0] out of memory for the sweep results\n");
+    MPI_Abort(MPI_COMM_WORLD,3);
+  }
+  int k=0;
+  for(int idx=0; idx<P; idx+=size,++k)
+   for(int x=0;x<T;++x) 
+   all[(size_t)x*P+idx]=local[(size_t)k*T+x];
+  for(int src=1; src<size; ++src){
+    int count=0;
+    MPI_Recv(&count,1,MPI_INT,src,108,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    MPI_Recv(buf,count*T*5,MPI_INT,src,109,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    int t=0;
+    for(int idx=src; idx<P && t<count; idx+=size,++t){
+        for(int x=0;x<T;++x){
+            const int* b=&buf[((size_t)t*T+x)*5];
+            MatchResult* m=&all[(size_t)x*P+idx];
+            m->pictureId=b[0]; 
+            m->found=b[1]; 
+            m->objectId=b[2]; 
+            m->posI=b[3]; 
+            m->posJ=b[4]; 
+            m->score=0.0;
+        }
+    }
+  }
+  if(dd){ 
+    MatchResult* full=(MatchResult*)malloc(((size_t)dd->P+1)*(size_t)T*sizeof(MatchResult)); 
+    for(int x=0;x<T && full;++x){ 
+        MatchResult* row=dedup_expand_results(dd,&all[(size_t)x*P]); 
+        if(!row){ 
+            free(full); 
+            full=NULL; 
+            break; 
+        } 
+        memcpy(&full[(size_t)x*dd->P],row,(size_t)dd->P*sizeof(MatchResult)); 
+        free(row); 
+    } 
+    if(!full){ 
+        fprintf(stderr,"[rank 0] out of memory expanding duplicate results\n"); 
+        MPI_Abort(MPI_COMM_WORLD,3); 
+    } 
+    free(all); 
+    all=full; 
+    P=dd->P; 
+  }
+  phase_enter(PHASE_WRITE);
+  fprintf(stderr, "[rank %d] writing results to %s\n", rank, outPath);
+  write_output_sweep(outPath,thr,T,all,P);
+  free(all);
+  free(buf);
+ } else {
+  int* buf=(int*)malloc(((size_t)lc*T+1)*5*sizeof(int));
+  if(!buf){
+    fprintf(stderr,"[rank %d] out of memory for the sweep results\n",rank);
+    MPI_Abort(MPI_COMM_WORLD,3);
+  }
+  for(int e=0;e<lc*T;++e){
+    buf[e*5+0]=local[e].pictureId; 
+    buf[e*5+1]=local[e].found; 
+    buf[e*5+2]=local[e].objectId; 
+    buf[e*5+3]=local[e].posI; 
+    buf[e*5+4]=local[e].posJ; 
+  }
+  MPI_Send(&lc,1,MPI_INT,0,108,MPI_COMM_WORLD);
+  MPI_Send(buf,lc*T*5,MPI_INT,0,109,MPI_COMM_WORLD);
+  free(buf);
+ }
+ free(local);
+}
+
+// Estimated cost of the (picture, object) pair t, (N-n+1)^2 * n^2 pixel comparisons; 0 when the object 
+// does not fit.
+static double pair_cost(const Picture* pics,const ObjectT* objs,int M,long long t){
+ const int N=pics[t/M].N, n=objs[t%M].n;
+ if(n>N) 
+ return 0.0;
+ return (double)(N-n+1)*(N-n+1)*n*n;
+}
+
+// This helper decides which (picture, object) pairs this rank searches in the match-matrix mode. The 
+// whole P*M pair space is flattened in pair index order (picture-major) and cut into 'size' contiguous 
+// ranges of equal estimated cost (pair_cost): pair t goes to the rank whose share of the total cost its 
+// cost prefix starts in. Every rank runs the same deterministic computation, so no communication is 
+// needed, and only the pairs of this rank are stored: it returns their number and sets *mine to them in 
+// ascending order. Pairs where the object does not fit are dropped. Returns -1 if memory runs out.
+static long long assign_pairs(const Picture* pics,int P,const ObjectT* objs,int M,int rank,int size,long long** mine){
+ const long long total=(long long)P*M;
+ double all=0.0;
+ for(long long t=0;t<total;++t) 
+ all+=pair_cost(pics,objs,M,t);
+ // Two walks over the pair space: the first counts this rank's pairs, the second stores them
+ long long cnt=0;
+ *mine=NULL;
+ for(int pass=0;pass<2;++pass){
+    double prefix=0.0;
+    cnt=0;
+    for(long long t=0;t<total;++t){
+        const double c=pair_cost(pics,objs,M,t);
+        if(c<=0.0) 
+        continue;
+        int owner=(int)(prefix/all*size);
+        if(owner>=size) owner=size-1;
+        prefix+=c;
+        if(owner!=rank) 
+        continue;
+        if(pass==1) (*mine)[cnt]=t;
+        cnt++;
+    }
+    if(pass==0){
+        *mine=(long long*)malloc(((size_t)cnt+1)*sizeof(long long));
+        if(!*mine) 
+        return -1;
+    }
+}
+ return cnt;
+}
+
+// One matched pair of the match-matrix mode as it travels to rank 0.
+typedef struct{
+    long long pair;
+    int posI;
+    int posJ;
+} 
+PairHit;
+
+// Finds the hit of pair u in hits[0..n), which is sorted by pair index; NULL if u did not match.
+static const PairHit* find_pair_hit(const PairHit* hits,long long n,long long u){
+ long long lo=0, hi=n;
+ while(lo<hi){
+    const long long mid=lo+(hi-lo)/2;
+    if(hits[mid].pair<u) lo=mid+1; 
+    else hi=mid;
+}
+ return lo<n && hits[lo].pair==u?&hits[lo]:NULL;
+}
+
+// This function runs the match-matrix mode: for every (picture, object) pair, whether and where the 
+// object first matches. Pairs are scheduled as one flat task space (see assign_pairs and 
+// pds_search_pairs) rather than inside the per-picture loop. Each rank keeps only the pairs that matched 
+// as PairHit records; rank 0 gathers the per-rank hit counts first, so its table holds only the matches, 
+// and receives the records rank by rank. Ranks own ascending ranges of pair indices, so the concatenation 
+// is already in pair index order, which is picture-major input order, and rank 0 writes the sparse pair 
+// list. Records travel as a contiguous datatype in chunks, so no count overflows an int.
+static void run_matrix_mode(const Picture* pics,int P,const ObjectT* objs,int M,PdsContext* ctx,double threshold,const Dedup* dd,int rank,int size,const char* outPath){
+ long long* mine=NULL;
+ const long long cnt=assign_pairs(pics,P,objs,M,rank,size,&mine);
+ MatchResult* res=cnt>=0?(MatchResult*)malloc(((size_t)cnt+1)*sizeof(MatchResult)):NULL;
+ if(!res||!pds_search_pairs(ctx,pics,mine,cnt,threshold,res)){
+    fprintf(stderr,"[rank %d] out of memory for the match matrix\n",rank);
+    MPI_Abort(MPI_COMM_WORLD,3);
+}
+ phase_enter(PHASE_GATHER);
+ report_search_stats(rank);
+ long long found=0;
+ for(long long t=0;t<cnt;++t) 
+ found+=res[t].found;
+ PairHit* buf=(PairHit*)malloc(((size_t)found+1)*sizeof(PairHit));
+ if(!buf){
+    fprintf(stderr,"[rank %d] out of memory for the match matrix\n",rank);
+    MPI_Abort(MPI_COMM_WORLD,3);
+}
+ found=0;
+ for(long long t=0;t<cnt;++t){
+    if(!res[t].found) 
+    continue;
+    buf[found].pair=mine[t]; 
+    buf[found].posI=res[t].posI; 
+    buf[found].posJ=res[t].posJ; 
+    found++;
+}
+ free(res);
+ free(mine);
+ MPI_Datatype hitType;
+ MPI_Type_contiguous((int)sizeof(PairHit),MPI_BYTE,&hitType);
+ MPI_Type_commit(&hitType);
+ const long long chunk=1<<24;
+ long long* counts=rank==0?(long long*)malloc((size_t)size*sizeof(long long)):NULL;
+ if(rank==0 && !counts){
+    fprintf(stderr,"[rank 0] out of memory for the match matrix\n");
+    MPI_Abort(MPI_COMM_WORLD,3);
+}
+ MPI_Gather(&found,1,MPI_LONG_LONG,counts,1,MPI_LONG_LONG,0,MPI_COMM_WORLD);
+ if(rank==0){
+  long long total=0;
+  for(int q=0;q<size;++q) 
+  total+=counts[q];
+  PairHit* all=(PairHit*)malloc(((size_t)total+1)*sizeof(PairHit));
+  if(!all){
+    fprintf(stderr,"[rank 0] out of memory for the match matrix\n");
+    MPI_Abort(MPI_COMM_WORLD,3);
+  }
+  memcpy(all,buf,(size_t)found*sizeof(PairHit));
+  long long at=found;
+  for(int src=1; src<size; ++src){
+    for(long long e=0;e<counts[src];e+=chunk){
+        const int c=(int)(counts[src]-e<chunk?counts[src]-e:chunk);
+        MPI_Recv(all+at+e,c,hitType,src,111,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    }
+    at+=counts[src];
+  }
+  // With duplicates, every input pair (picture, object) takes the answer of its unique pair
+  const int PI=dd?dd->P:P, MI=dd?dd->M:M; 
+  long long cap=total; 
+  if(dd){ 
+    cap=0; 
+    for(long long t=0;t<(long long)PI*MI;++t) 
+    cap+=find_pair_hit(all,total,(long long)dd->picOf[t/MI]*M+dd->objOf[t%MI])!=NULL; 
+  }
+  MatchResult* out=(MatchResult*)malloc(((size_t)cap+1)*sizeof(MatchResult));
+  if(!out){
+    fprintf(stderr,"[rank 0] out of memory for the match matrix\n");
+    MPI_Abort(MPI_COMM_WORLD,3);
+  }
+  long long k=0;
+  for(long long t=0;dd && t<(long long)PI*MI;++t){
+    const PairHit* h=find_pair_hit(all,total,(long long)dd->picOf[t/MI]*M+dd->objOf[t%MI]); 
+    if(!h) 
+    continue;
+    out[k].pictureId=dd->picId[t/MI]; 
+    out[k].objectId=dd->objId[t%MI]; 
+    out[k].posI=h->posI; 
+    out[k++].posJ=h->posJ; 
+  }
+  for(long long e=0;!dd && e<total;++e){
+    out[k].pictureId=pics[all[e].pair/M].id; 
+    out[k].objectId=objs[all[e].pair%M].id; 
+    out[k].posI=all[e].posI; 
+    out[k++].posJ=all[e].posJ; 
+  }
+  for(long long e=0;e<k;++e){
+    out[e].found=1; 
+    out[e].score=0.0; 
+    out[e].orientation=0; 
+  }
+  phase_enter(PHASE_WRITE);
+  fprintf(stderr, "[rank %d] writing results to %s\n", rank, outPath);
+  write_output_pairs(outPath,out,k);
+  free(out);
+  free(all);
+ } else {
+  for(long long e=0;e<found;e+=chunk){
+    const int c=(int)(found-e<chunk?found-e:chunk);
+    MPI_Send(buf+e,c,hitType,0,111,MPI_COMM_WORLD);
+  }
+ }
+ MPI_Type_free(&hitType);
+ free(counts);
+ free(buf);
+}
+
 // This is the main program that coordinates parallel pattern matching across multiple processes. 
 // First, it initializes MPI and checks command line arguments. Then process 0 reads the input file 
 // containing pictures and objects to search for. All processes receive copies of this data through 
@@ -37,12 +1000,32 @@ int main(int argc,char** argv){
   MPI_Comm_size(MPI_COMM_WORLD,&size);
  if(argc<3){ 
   if(rank==0) 
-  fprintf(stderr,"Usage: %s <input.txt> <output.txt>\n",argv[0]); 
+  fprintf(stderr,"Usage: %s <input.txt> <output.txt> [--mode first|all|best|topk|matrix] [--k K] [--thresholds t1,t2,...] [--roi roi.txt] [--symmetric] [--stride s] [--refine-factor f] [--recall] [--sample S] [--sample-mode exact|prob] [--confidence z] [--daemon socket|-] [--sequence] [--radius R] [--cache dir] [--cache-size MB] [--no-dedup] [--cluster R] [--trie] [--trace file] [--trace-sample N]\n",argv[0]); 
 MPI_Finalize(); 
 return 1; 
+}
+ RunOptions opt; 
+ if(!parse_options(argc,argv,&opt)){ 
+  if(rank==0) 
+  fprintf(stderr,"Unknown option or unsupported combination. Usage: %s <input.txt> <output.txt> [--mode first|all|best|topk|matrix] [--k K] [--thresholds t1,t2,...] [--roi roi.txt] [--symmetric] [--stride s] [--refine-factor f] [--recall] [--sample S] [--sample-mode exact|prob] [--confidence z] [--daemon socket|-] [--sequence] [--radius R] [--cache dir] [--cache-size MB] [--no-dedup] [--cluster R] [--trie] [--trace file] [--trace-sample N]\n",argv[0]); 
+  MPI_Finalize(); 
+  return 1; 
+}
+ if(opt.daemon && size!=1){ 
+  if(rank==0) 
+  fprintf(stderr,"--daemon runs as a single MPI rank (mpirun -np 1)\n"); 
+  MPI_Finalize(); 
+  return 1; 
 }
  const char* inPath=argv[1]; 
  const char* outPath=argv[2];
+ // All ranks start the trace clock together, so their timelines line up
+ if(opt.tracePath){ 
+  MPI_Barrier(MPI_COMM_WORLD); 
+  if(!trace_start(opt.traceSample,1<<16)) 
+  fprintf(stderr,"[rank %d] out of memory for the trace buffers, tracing disabled\n",rank); 
+ }
+ phase_enter(PHASE_PARSE); 
  double threshold=0.0; 
  Picture* pics_root=NULL; 
  int P_root=0; 
@@ -58,12 +1041,49 @@ return 1;
     fprintf(stderr,"Input parsing failed.\n"); 
     MPI_Abort(MPI_COMM_WORLD,2);
   } 
+  if(opt.roiPath && !read_roi(opt.roiPath,pics_root,P_root)){
+    fprintf(stderr,"ROI parsing failed.\n"); 
+    MPI_Abort(MPI_COMM_WORLD,2);
+  } 
   P=P_root; 
   M=M_root; 
+}
+ // Deduplication: rank 0 replaces the input by its unique pictures and objects (shallow copies of the 
+ // first copies) before the broadcast; 'dd' is only set on rank 0 and only when something was merged. 
+ // The daemon answers pictures it receives later, and a sequence depends on the frame order, so neither 
+ // is deduplicated. Objects are kept apart in the top-K mode, whose ties are broken by object id, and with 
+ // the probabilistic sampling, whose random samples are drawn object by object.
+ Dedup dedup; 
+ const Dedup* dd=NULL; 
+ Picture* srcPics=pics_root; 
+ ObjectT* srcObjs=objs_root; 
+ if(rank==0 && opt.dedup && !opt.daemon && !opt.sequence){ 
+  const bool objects=opt.mode!=SEARCH_TOPK && !(opt.sample>0 && opt.sampleProb); 
+  if(!dedup_build(&dedup,pics_root,P_root,objs_root,M_root,objects)){ 
+    fprintf(stderr,"[rank 0] out of memory deduplicating the input\n"); 
+    MPI_Abort(MPI_COMM_WORLD,3); 
+  } 
+  if(dedup.Pu<P_root || dedup.Mu<M_root){ 
+    srcPics=(Picture*)malloc(((size_t)dedup.Pu+1)*sizeof(Picture)); 
+    srcObjs=(ObjectT*)malloc(((size_t)dedup.Mu+1)*sizeof(ObjectT)); 
+    if(!srcPics||!srcObjs){ 
+      fprintf(stderr,"[rank 0] out of memory deduplicating the input\n"); 
+      MPI_Abort(MPI_COMM_WORLD,3); 
+    } 
+    for(int i=0;i<dedup.Pu;++i) 
+    srcPics[i]=pics_root[dedup.picFirst[i]]; 
+    for(int j=0;j<dedup.Mu;++j) 
+    srcObjs[j]=objs_root[dedup.objFirst[j]]; 
+    P=dedup.Pu; 
+    M=dedup.Mu; 
+    dd=&dedup; 
+    fprintf(stderr,"[rank 0] dedup: %d pictures -> %d unique, %d objects -> %d unique\n",P_root,P,M_root,M); 
+  } else dedup_free(&dedup); 
 }
 if (rank == 0) {
     fprintf(stderr, "[rank %d] finished reading %s\n", rank, inPath);
 }
+ phase_enter(PHASE_DISTRIBUTE); 
  bcast_double(&threshold); 
  bcast_int(&P); 
  bcast_int(&M);
@@ -72,8 +1092,8 @@ if (rank == 0) {
  for(int i=0;i<P;++i) {
   int id=0,N=0; 
   if(rank==0){
-    id=pics_root[i].id; 
-    N=pics_root[i].N;
+    id=srcPics[i].id; 
+    N=srcPics[i].N;
   } 
   bcast_int(&id); 
   bcast_int(&N);
@@ -85,16 +1105,17 @@ if (rank == 0) {
   }
 
   int count=N*N; 
-  int* buf=(rank==0)?pics_root[i].a:pics[i].a; 
+  int* buf=(rank==0)?srcPics[i].a:pics[i].a; 
   MPI_Bcast(buf,count,MPI_INT,0,MPI_COMM_WORLD); 
   if(rank==0) 
-  pics[i].a=pics_root[i].a; 
+  pics[i].a=srcPics[i].a; 
+  bcast_roi(&pics[i],rank==0?&srcPics[i]:NULL,rank); 
 }
  for(int j=0;j<M;++j){
   int id=0, n=0; 
   if(rank==0){
-    id=objs_root[j].id; 
-    n=objs_root[j].n;
+    id=srcObjs[j].id; 
+    n=srcObjs[j].n;
   } 
   bcast_int(&id); 
   bcast_int(&n);
@@ -106,40 +1127,177 @@ if (rank == 0) {
   }
 
   int count=n*n; 
-  int* buf=(rank==0)?objs_root[j].a:objs[j].a; 
+  int* buf=(rank==0)?srcObjs[j].a:objs[j].a; 
   MPI_Bcast(buf,count,MPI_INT,0,MPI_COMM_WORLD); 
   if(rank==0) 
-  objs[j].a=objs_root[j].a; 
+  objs[j].a=srcObjs[j].a; 
+  bcast_mask(&objs[j],rank==0?&srcObjs[j]:NULL,rank); 
+}
+ phase_enter(PHASE_COMPUTE); 
+ bool anyMask=false; 
+ for(int j=0;j<M;++j) 
+ anyMask|=objs[j].maskRow!=NULL; 
+ const SearchMode mode=opt.mode; 
+ // Every search goes through a libpds context, which prepares the value summaries, orientations and pixel 
+ // samples once (every rank draws the same samples, so they need no broadcast)
+ PdsOptions po; 
+ pds_default_options(&po); 
+ po.mode=mode; 
+ po.symmetric=opt.symmetric; 
+ po.sample=opt.sample; 
+ po.sampleProb=opt.sampleProb; 
+ po.confidence=opt.confidence; 
+ po.cluster=opt.cluster; 
+ po.trie=opt.trie; 
+ PdsContext* ctx=pds_create(objs,M,&po); 
+ if(!ctx){ 
+  fprintf(stderr,"[rank %d] out of memory preparing the search context\n",rank); 
+  MPI_Abort(MPI_COMM_WORLD,3); 
 }
+ if(opt.daemon){ 
+  if(run_daemon(opt.daemon,ctx,threshold)!=0) 
+  fprintf(stderr,"[rank %d] daemon stopped with an error\n",rank); 
+} else if(mode==SEARCH_ALL){ 
+  run_all_mode(pics,P,ctx,threshold,&opt,dd,rank,size,outPath); 
+} else if(mode==SEARCH_MATRIX){ 
+  run_matrix_mode(pics,P,objs,M,ctx,threshold,dd,rank,size,outPath); 
+} else if(mode==SEARCH_SWEEP){ 
+  run_sweep_mode(pics,P,ctx,opt.thresholds,opt.nThresholds,dd,rank,size,outPath); 
+} else if(mode==SEARCH_TOPK){ 
+  run_topk_mode(pics,P,ctx,threshold,opt.topK,dd,rank,size,outPath); 
+} else { 
  int local_cap=(P+size-1)/size; 
  MatchResult* local=(MatchResult*)malloc((size_t)local_cap*sizeof(MatchResult)); 
  int lc=0;
-for (int idx = rank; idx < P; idx += size) {
+ long long acc[4]={0,0,0,0};
+ // Result cache: rank 0 looks every picture up before anything is scheduled and tells the other ranks 
+ // which ones hit, so only the misses are searched
+ unsigned char* cached=(unsigned char*)calloc((size_t)P+1,1); 
+ MatchResult* hitRes=NULL; 
+ CacheKey* keys=NULL; 
+ ResultCache cache; 
+ bool useCache=false; 
+ if(opt.cachePath){ 
+  if(rank==0){ 
+    useCache=cache_open(&cache,opt.cachePath,opt.cacheLimit); 
+    hitRes=(MatchResult*)malloc(((size_t)P+1)*sizeof(MatchResult)); 
+    keys=(CacheKey*)malloc(((size_t)P+1)*sizeof(CacheKey)); 
+    useCache=useCache && hitRes && keys; 
+    if(useCache){ 
+      char tag[256]; 
+      snprintf(tag,sizeof tag,"mode=%d sym=%d stride=%d factor=%.17g sample=%d prob=%d z=%.17g seq=%d radius=%d",
+               (int)mode,(int)opt.symmetric,opt.stride,opt.refineFactor,opt.sample,(int)opt.sampleProb,opt.confidence,(int)opt.sequence,opt.radius); 
+      const unsigned long long lib=cache_library_hash(objs,M); 
+      for(int i=0;i<P;++i){ 
+        keys[i]=cache_key(&pics[i],lib,threshold,tag); 
+        if(cache_lookup(&cache,keys[i],&hitRes[i])){ 
+          hitRes[i].pictureId=pics[i].id; 
+          cached[i]=1; 
+        } 
+      } 
+    } else fprintf(stderr,"[rank 0] result cache disabled\n"); 
+  } 
+  MPI_Bcast(cached,P,MPI_UNSIGNED_CHAR,0,MPI_COMM_WORLD); 
+}
+ int* todo=(int*)malloc(((size_t)P+1)*sizeof(int)); 
+ int nTodo=0; 
+ for(int i=0;i<P;++i) 
+ if(!cached[i]) todo[nTodo++]=i; 
+ // Pictures are dealt round-robin; a sequence gives every rank one contiguous block of frames instead, 
+ // so that each frame (but the first of a block) has its predecessor's match on the same rank
+ int lo=rank, hi=nTodo, step=size; 
+ if(opt.sequence){ 
+  lo=(int)((long long)nTodo*rank/size); 
+  hi=(int)((long long)nTodo*(rank+1)/size); 
+  step=1; 
+}
+ long long seq[2]={0,0};
+ int lastFound=-1;
+for (int t = lo; t < hi; t += step) {
+    const int idx = todo[t];
     MatchResult r;
+    if (opt.sequence) {
+        // Temporal coherence: probe around the last match of this block (frames without a match don't 
+        // reset it), fall back to the full search
+        seq[0] += pds_search_near(ctx, &pics[idx], threshold, lastFound >= 0 ? &local[lastFound] : NULL, opt.radius, &r);
+        seq[1] += r.found;
+        if (r.found) lastFound = lc;
+        local[lc++] = r;
+        continue;
+    }
+    if (opt.stride > 1 && !opt.recall) {
+        // Coarse grid + refinement, stopping at the first object with a refined hit
+        if (pds_search_strided(ctx, &pics[idx], threshold, opt.stride, opt.refineFactor, &r) < 0) {
+            fprintf(stderr, "[rank %d] out of memory searching picture %d\n", rank, pics[idx].id);
+            MPI_Abort(MPI_COMM_WORLD, 3);
+        }
+        local[lc++] = r;
+        continue;
+    }
+    if (opt.stride > 1) {
+        // The recall needs every strided hit; the first one in (object, i, j) order is the answer
+        MatchList l = {0, 0, 0, NULL};
+        if (pds_search_all_strided(ctx, &pics[idx], threshold, opt.stride, opt.refineFactor, &l) < 0) {
+            fprintf(stderr, "[rank %d] out of memory collecting matches for picture %d\n", rank, pics[idx].id);
+            MPI_Abort(MPI_COMM_WORLD, 3);
+        }
+        r.pictureId = pics[idx].id;
+        r.found = l.count > 0;
+        r.objectId = r.found ? l.hits[0].objectId : -1;
+        r.posI = r.found ? l.hits[0].posI : -1;
+        r.posJ = r.found ? l.hits[0].posJ : -1;
+        r.score = 0.0;
+        r.orientation = 0;
+        if (opt.recall) accumulate_recall(ctx, &pics[idx], threshold, &l, acc);
+        match_list_free(&l);
+        local[lc++] = r;
+        continue;
+    }
+    if (opt.symmetric || mode == SEARCH_BEST) {
+        // The orientation-invariant search and the best-match branch-and-bound only exist on the CPU
+        pds_search(ctx, &pics[idx], threshold, &r);
+        local[lc++] = r;
+        continue;
+    }
 #ifdef USE_CUDA
     // Try GPU first. If no GPU / error / no match on GPU → fall back to CPU.
-    if (!cuda_find_match_for_picture(&pics[idx], objs, M, threshold, &r)) {
-        find_match_for_picture(&pics[idx], objs, M, threshold, &r);
+    // The kernel scans the full picture with dense objects, so ROIs, masks and sampling go straight to the CPU path.
+    if (pics[idx].roiRow || anyMask || opt.sample > 0 || opt.cluster > 0 || opt.trie || !cuda_find_match_for_picture(&pics[idx], objs, M, threshold, &r)) {
+        pds_search(ctx, &pics[idx], threshold, &r);
     }
 #else
     // No CUDA build: use the existing CPU/OpenMP path
-    find_match_for_picture(&pics[idx], objs, M, threshold, &r);
+    pds_search(ctx, &pics[idx], threshold, &r);
 #endif
     local[lc++] = r;
 }
+ phase_enter(PHASE_GATHER);
+ report_search_stats(rank);
+ if(opt.recall && opt.stride>1) 
+ report_recall(acc,rank,opt.stride,opt.refineFactor);
+ if(opt.sequence){ 
+  long long tot[2]={0,0}; 
+  MPI_Reduce(seq,tot,2,MPI_LONG_LONG,MPI_SUM,0,MPI_COMM_WORLD); 
+  if(rank==0) 
+  fprintf(stderr,"[rank 0] sequence: %lld of %lld matched frames found within radius %d of the previous match\n",tot[0],tot[1],opt.radius); 
+}
 
  if(rank==0){ 
   MatchResult* all=(MatchResult*)malloc((size_t)P*sizeof(MatchResult)); 
   int k=0; 
-  for(int idx=rank; idx<P; idx+=size) 
-  all[idx]=local[k++];
+  for(int t=lo; t<hi; t+=step) 
+  all[todo[t]]=local[k++];
+  for(int i=0;i<P;++i) 
+  if(cached[i]) all[i]=hitRes[i];
   for(int src=1; src<size; ++src){ 
     int count=0; 
     MPI_Recv(&count,1,MPI_INT,src,100,MPI_COMM_WORLD,MPI_STATUS_IGNORE); 
-    int* buf=(int*)malloc((size_t)count*5*sizeof(int));
-   MPI_Recv(buf,count*5,MPI_INT,src,101,MPI_COMM_WORLD,MPI_STATUS_IGNORE); 
+    int* buf=(int*)malloc((size_t)count*6*sizeof(int));
+   MPI_Recv(buf,count*6,MPI_INT,src,101,MPI_COMM_WORLD,MPI_STATUS_IGNORE); 
+   double* scores=(double*)malloc((size_t)(count>0?count:1)*sizeof(double));
+   MPI_Recv(scores,count,MPI_DOUBLE,src,104,MPI_COMM_WORLD,MPI_STATUS_IGNORE); 
    for(int t=0;t<count;++t){ 
-    int pictureId=buf[t*5+0], found=buf[t*5+1], objectId=buf[t*5+2], posI=buf[t*5+3], posJ=buf[t*5+4];
+    int pictureId=buf[t*6+0], found=buf[t*6+1], objectId=buf[t*6+2], posI=buf[t*6+3], posJ=buf[t*6+4], orientation=buf[t*6+5];
     int idxPic=-1; 
     for(int i=0;i<P;++i){ 
       if(pics[i].id==pictureId){ 
@@ -152,47 +1310,110 @@ for (int idx = rank; idx < P; idx += size) {
         all[idxPic].objectId=objectId; 
         all[idxPic].posI=posI; 
         all[idxPic].posJ=posJ; 
+        all[idxPic].score=scores[t]; 
+        all[idxPic].orientation=orientation; 
       } } 
       free(buf); 
+      free(scores); 
     }
+    phase_enter(PHASE_WRITE);
     if (rank == 0) {
     fprintf(stderr, "[rank %d] writing results to %s\n", rank, outPath);
 }
 
-  write_output(outPath,all,P); 
+  if(useCache){ 
+    for(int i=0;i<P;++i) 
+    if(!cached[i]) cache_store(&cache,keys[i],&all[i]); 
+    cache_close(&cache); 
+    fprintf(stderr,"[rank 0] result cache: %lld hits, %lld misses, %lld stored, %lld evicted\n",cache.hits,cache.misses,cache.stores,cache.evictions); 
+  } 
+  MatchResult* full=all; 
+  int outP=P; 
+  if(dd){ 
+    full=dedup_expand_results(dd,all); 
+    outP=dd->P; 
+    if(!full){ 
+      fprintf(stderr,"[rank 0] out of memory expanding duplicate results\n"); 
+      MPI_Abort(MPI_COMM_WORLD,3); 
+    } 
+  } 
+  if(mode==SEARCH_BEST) 
+  write_output_best(outPath,full,outP); 
+  else if(opt.symmetric) 
+  write_output_oriented(outPath,full,outP); 
+  else write_output(outPath,full,outP); 
+  if(full!=all) 
+  free(full); 
   free(all);
  } else { 
   MPI_Send(&lc,1,MPI_INT,0,100,MPI_COMM_WORLD); 
-  int* buf=(int*)malloc((size_t)lc*5*sizeof(int)); 
+  int* buf=(int*)malloc((size_t)lc*6*sizeof(int)); 
   for(int i=0;i<lc;++i){ 
-    buf[i*5+0]=local[i].pictureId; 
-    buf[i*5+1]=local[i].found; 
-    buf[i*5+2]=local[i].objectId; 
-    buf[i*5+3]=local[i].posI; 
-    buf[i*5+4]=local[i].posJ; 
+    buf[i*6+0]=local[i].pictureId; 
+    buf[i*6+1]=local[i].found; 
+    buf[i*6+2]=local[i].objectId; 
+    buf[i*6+3]=local[i].posI; 
+    buf[i*6+4]=local[i].posJ; 
+    buf[i*6+5]=local[i].orientation; 
   } 
-  MPI_Send(buf,lc*5,MPI_INT,0,101,MPI_COMM_WORLD); 
+  MPI_Send(buf,lc*6,MPI_INT,0,101,MPI_COMM_WORLD); 
+  double* scores=(double*)malloc((size_t)(lc>0?lc:1)*sizeof(double)); 
+  for(int i=0;i<lc;++i) 
+  scores[i]=local[i].score; 
+  MPI_Send(scores,lc,MPI_DOUBLE,0,104,MPI_COMM_WORLD); 
   free(buf); 
+  free(scores); 
 }
  free(local); 
+ free(todo); 
+ free(cached); 
+ free(hitRes); 
+ free(keys); 
+}
+ phase_enter(-1); 
+ if(!opt.daemon) 
+ report_phases(rank,size,outPath,objs,M); 
+ if(opt.tracePath) 
+ write_trace(rank,size,opt.tracePath); 
+ pds_destroy(ctx); 
  if(rank==0){ 
-  for(int i=0;i<P_root;++i) 
+  for(int i=0;i<P_root;++i){ 
   free(pics_root[i].a); 
-  for(int j=0;j<M_root;++j) 
+  free(pics_root[i].roiRow); 
+  free(pics_root[i].roiSpan); 
+  } 
+  for(int j=0;j<M_root;++j){ 
   free(objs_root[j].a); 
+  free(objs_root[j].maskRow); 
+  free(objs_root[j].maskCol); 
+  free(objs_root[j].maskVal); 
+  } 
   free(pics_root); 
   free(objs_root); 
   free(pics); 
   free(objs); 
+  if(dd){ 
+    free(srcPics); 
+    free(srcObjs); 
+    dedup_free(&dedup); 
+  } 
 }
  else { 
-  for(int i=0;i<P;++i) 
+  for(int i=0;i<P;++i){ 
   free(pics[i].a); 
-for(int j=0;j<M;++j) 
+  free(pics[i].roiRow); 
+  free(pics[i].roiSpan); 
+  } 
+for(int j=0;j<M;++j){ 
 free(objs[j].a); 
+free(objs[j].maskRow); 
+free(objs[j].maskCol); 
+free(objs[j].maskVal); 
+} 
 free(pics); 
 free(objs); 
 }
+ free(opt.thresholds); 
  MPI_Finalize(); 
  return 0;
 }
@@ -0,0 +1,299 @@
+#include "pds.h"
+#include "compute.h"
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct PdsContext{
+    PdsOptions opt;
+    int M;
+    ObjectT* objs;
+    SymObject* sym;
+    ObjectTrie* trie;
+};
+
+struct PdsFrame{
+    IncrementalState st;
+};
+
+void pds_default_options(PdsOptions* opt){
+ opt->mode=SEARCH_FIRST;
+ opt->symmetric=false;
+ opt->threads=0;
+ opt->sample=0;
+ opt->sampleProb=false;
+ opt->confidence=3.0;
+ opt->cluster=0.0;
+ opt->trie=false;
+}
+
+// Copies n ints, or returns NULL for a NULL source; *ok is cleared when memory runs out.
+static int* copy_ints(const int* src,size_t n,bool* ok){
+ if(!src)
+ return NULL;
+ int* dst=(int*)malloc((n+1)*sizeof(int));
+ if(!dst){
+    *ok=false;
+    return NULL;
+}
+ memcpy(dst,src,n*sizeof(int));
+ return dst;
+}
+
+static void free_objects(ObjectT* objs,int M){
+ if(!objs)
+ return;
+ free_sample_plans(objs,M);
+ free_value_summaries(objs,M);
+ free_object_clusters(objs,M);
+ for(int k=0;k<M;++k){
+    free(objs[k].a);
+    free(objs[k].maskRow);
+    free(objs[k].maskCol);
+    free(objs[k].maskVal);
+}
+ free(objs);
+}
+
+// This function creates a search context. The objects are deep-copied (the caller may free its own
+// array right away), then the per-object preprocessing is done once: the value summaries of the pair
+// prefilter and, if the options ask for them, the pixel samples of the sampling prefilter, the object
+// clusters of the similarity pruning, the object trie of the prefix-sharing search and the deduplicated
+// orientations of the symmetric search. Option combinations the engines don't support (symmetric with
+// anything but the first-match search, sampling or clusters with the best-match search, clusters with the
+// symmetric search, the trie with anything but plain first/all searches, any of them with the top-K,
+// sweep and matrix modes) are rejected. Returns NULL on bad options or when memory runs out.
+PdsContext* pds_create(const ObjectT* objs,int M,const PdsOptions* opt){
+ if(opt->mode!=SEARCH_FIRST && opt->mode!=SEARCH_BEST && opt->mode!=SEARCH_ALL && 
+    (opt->symmetric || opt->sample>0 || opt->cluster>0 || opt->trie))
+ return NULL;
+ if(opt->symmetric && (opt->mode!=SEARCH_FIRST || opt->sample>0))
+ return NULL;
+ if(opt->sample>0 && opt->mode==SEARCH_BEST)
+ return NULL;
+ if(opt->cluster>0 && (opt->mode==SEARCH_BEST || opt->symmetric))
+ return NULL;
+ if(opt->trie && (opt->mode==SEARCH_BEST || opt->symmetric || opt->sample>0 || opt->cluster>0))
+ return NULL;
+ PdsContext* ctx=(PdsContext*)calloc(1,sizeof(PdsContext));
+ if(!ctx)
+ return NULL;
+ ctx->opt=*opt;
+ ctx->M=M;
+ ctx->objs=(ObjectT*)calloc((size_t)M+1,sizeof(ObjectT));
+ bool ok=ctx->objs!=NULL;
+ for(int k=0;k<M && ok;++k){
+    const ObjectT* s=&objs[k];
+    ObjectT* d=&ctx->objs[k];
+    const size_t n=(size_t)s->n;
+    const size_t active=s->maskRow?(size_t)s->maskRow[n]:0;
+    d->id=s->id;
+    d->n=s->n;
+    d->a=copy_ints(s->a,n*n,&ok);
+    d->maskRow=copy_ints(s->maskRow,n+1,&ok);
+    d->maskCol=copy_ints(s->maskCol,active,&ok);
+    d->maskVal=copy_ints(s->maskVal,active,&ok);
+}
+ if(ok)
+ ok=prepare_value_summaries(ctx->objs,M);
+ if(ok && opt->sample>0)
+ ok=prepare_sample_plans(ctx->objs,M,opt->sample,opt->sampleProb,opt->confidence,0x5DEECE66DULL);
+ if(ok && opt->cluster>0)
+ ok=prepare_object_clusters(ctx->objs,M,opt->cluster);
+ if(ok && opt->trie){
+    ctx->trie=prepare_object_trie(ctx->objs,M);
+    ok=ctx->trie!=NULL;
+}
+ if(ok && opt->symmetric){
+    ctx->sym=prepare_symmetric_objects(ctx->objs,M);
+    ok=ctx->sym!=NULL;
+}
+ if(!ok){
+    pds_destroy(ctx);
+    return NULL;
+}
+ return ctx;
+}
+
+const PdsOptions* pds_options(const PdsContext* ctx){
+ return &ctx->opt;
+}
+
+// The engines open their own parallel regions from the calling thread, so the context's thread count is
+// applied to that thread for the duration of the call. The OpenMP runtime keeps its pool alive between
+// calls, so only the first search of a process pays for starting the threads.
+static int enter_threads(const PdsContext* ctx){
+ const int prev=omp_get_max_threads();
+ if(ctx->opt.threads>0)
+ omp_set_num_threads(ctx->opt.threads);
+ return prev;
+}
+
+static void leave_threads(const PdsContext* ctx,int prev){
+ if(ctx->opt.threads>0)
+ omp_set_num_threads(prev);
+}
+
+// This function runs the context's single-result search (first match, best match or the orientation-
+// invariant first match) on one picture. Returns true if a match was found; out is filled either way.
+bool pds_search(PdsContext* ctx,const Picture* pic,double threshold,MatchResult* out){
+ const int prev=enter_threads(ctx);
+ bool found;
+ if(ctx->sym)
+ found=find_match_for_picture_sym(pic,ctx->sym,ctx->M,threshold,out);
+ else if(ctx->opt.mode==SEARCH_BEST)
+ found=find_best_match_for_picture(pic,ctx->objs,ctx->M,threshold,out);
+ else if(ctx->trie)
+ found=find_match_trie(pic,ctx->trie,ctx->objs,threshold,out);
+ else found=find_match_for_picture(pic,ctx->objs,ctx->M,threshold,out);
+ leave_threads(ctx,prev);
+ return found;
+}
+
+// Same as pds_search for a plain row-major N x N pixel buffer; the buffer is only read.
+bool pds_search_buffer(PdsContext* ctx,int id,int N,const int* pixels,double threshold,MatchResult* out){
+ Picture pic={id,N,(int*)pixels,NULL,NULL};
+ return pds_search(ctx,&pic,threshold,out);
+}
+
+// This function collects every matching (object, position) of one picture, see
+// find_all_matches_for_picture. Returns the number of hits or -1 if memory runs out; free the list with
+// match_list_free.
+int pds_search_all(PdsContext* ctx,const Picture* pic,double threshold,MatchList* out){
+ const int prev=enter_threads(ctx);
+ const int count=ctx->trie?find_all_matches_trie(pic,ctx->trie,ctx->objs,threshold,out)
+                          :find_all_matches_for_picture(pic,ctx->objs,ctx->M,threshold,out);
+ leave_threads(ctx,prev);
+ return count;
+}
+
+// This function is the sequence variant of pds_search for the first-match mode: when the previous frame 
+// matched (prev->found), the matched object is first probed in rings of up to 'radius' around its old 
+// position (find_match_near); otherwise, or if that finds nothing, the full search runs. Returns 1 when 
+// the answer came from the probe and 0 when the full search ran; out->found tells whether anything matched.
+int pds_search_near(PdsContext* ctx,const Picture* pic,double threshold,const MatchResult* prev,int radius,MatchResult* out){
+ if(prev && prev->found && !ctx->sym && ctx->opt.mode==SEARCH_FIRST){
+    const int prevThreads=enter_threads(ctx);
+    const bool near=find_match_near(pic,ctx->objs,ctx->M,threshold,prev->objectId,prev->posI,prev->posJ,radius,out);
+    leave_threads(ctx,prevThreads);
+    if(near)
+    return 1;
+}
+ pds_search(ctx,pic,threshold,out);
+ return 0;
+}
+
+// This function is the coarse-grid first-match search (find_match_strided): 'stride' is the grid step and 
+// 'factor' how far above the threshold a grid point may score and still be refined. It needs a context 
+// without the symmetric search, the trie, samples or clusters. Returns 1 if a match was found, 0 if not 
+// and -1 if memory runs out.
+int pds_search_strided(PdsContext* ctx,const Picture* pic,double threshold,int stride,double factor,MatchResult* out){
+ const int prev=enter_threads(ctx);
+ const int found=find_match_strided(pic,ctx->objs,ctx->M,threshold,stride,factor,out);
+ leave_threads(ctx,prev);
+ return found;
+}
+
+// All-matches version of pds_search_strided (find_all_matches_strided). Returns the number of hits or -1 
+// if memory runs out; free the list with match_list_free.
+int pds_search_all_strided(PdsContext* ctx,const Picture* pic,double threshold,int stride,double factor,MatchList* out){
+ const int prev=enter_threads(ctx);
+ const int count=find_all_matches_strided(pic,ctx->objs,ctx->M,threshold,stride,factor,out);
+ leave_threads(ctx,prev);
+ return count;
+}
+
+// This function writes the K lowest-scoring (object, position) candidates below the threshold of one 
+// picture to out[0..K), best first (find_topk_matches_for_picture). Returns their number or -1 if memory 
+// runs out.
+int pds_search_topk(PdsContext* ctx,const Picture* pic,double threshold,int K,ScoredMatch* out){
+ const int prev=enter_threads(ctx);
+ const int count=find_topk_matches_for_picture(pic,ctx->objs,ctx->M,threshold,K,out);
+ leave_threads(ctx,prev);
+ return count;
+}
+
+// This function runs the first-match search of one picture for T thresholds at once 
+// (find_first_matches_multi); out[x] is the answer for thresholds[x]. Returns true if any threshold matched.
+bool pds_search_sweep(PdsContext* ctx,const Picture* pic,const double* thresholds,int T,MatchResult* out){
+ const int prev=enter_threads(ctx);
+ const bool ok=find_first_matches_multi(pic,ctx->objs,ctx->M,thresholds,T,out);
+ leave_threads(ctx,prev);
+ return ok;
+}
+
+// This function finds the first match of every listed (picture, object) pair, where pair t is picture 
+// t/M of 'pics' and object t%M of the context (find_pair_matches); out[x] is the answer for pairs[x]. 
+// Returns false if memory runs out.
+bool pds_search_pairs(PdsContext* ctx,const Picture* pics,const long long* pairs,long long count,double threshold,MatchResult* out){
+ const int prev=enter_threads(ctx);
+ const bool ok=find_pair_matches(pics,ctx->objs,ctx->M,pairs,count,threshold,out);
+ leave_threads(ctx,prev);
+ return ok;
+}
+
+void pds_destroy(PdsContext* ctx){
+ if(!ctx)
+ return;
+ free_symmetric_objects(ctx->sym,ctx->M);
+ free_object_trie(ctx->trie);
+ free_objects(ctx->objs,ctx->M);
+ free(ctx);
+}
+
+// This function starts tracking a picture for incremental searches (first, best and all modes; the
+// orientation-invariant search has no incremental variant). The pixels are copied. Returns NULL for a
+// symmetric context or when memory runs out.
+PdsFrame* pds_frame_create(PdsContext* ctx,const Picture* pic){
+ if(ctx->sym)
+ return NULL;
+ PdsFrame* f=(PdsFrame*)malloc(sizeof(PdsFrame));
+ if(!f)
+ return NULL;
+ const int prev=enter_threads(ctx);
+ const bool ok=incremental_init(&f->st,pic,ctx->objs,ctx->M);
+ leave_threads(ctx,prev);
+ if(!ok){
+    free(f);
+    return NULL;
+}
+ return f;
+}
+
+// Replaces the h x w pixels at (r0,c0) of a tracked picture; pixels is row-major h*w.
+bool pds_frame_update(PdsContext* ctx,PdsFrame* f,int r0,int c0,int h,int w,const int* pixels){
+ const int prev=enter_threads(ctx);
+ const bool ok=incremental_update(&f->st,ctx->objs,ctx->M,r0,c0,h,w,pixels);
+ leave_threads(ctx,prev);
+ return ok;
+}
+
+// Single-result search of a tracked picture. The first-match mode returns the first hit in (object, i, j)
+// order, so it is deterministic here.
+bool pds_frame_search(PdsContext* ctx,PdsFrame* f,double threshold,MatchResult* out){
+ const int prev=enter_threads(ctx);
+ const bool found=incremental_find(&f->st,ctx->objs,ctx->M,threshold,ctx->opt.mode,out);
+ leave_threads(ctx,prev);
+ return found;
+}
+
+int pds_frame_search_all(PdsContext* ctx,PdsFrame* f,double threshold,MatchList* out){
+ const int prev=enter_threads(ctx);
+ const int count=incremental_find_all(&f->st,ctx->objs,ctx->M,threshold,out);
+ leave_threads(ctx,prev);
+ return count;
+}
+
+// Work counters of a frame since it was created: exact window scores computed, and windows whose cached
+// value was recomputed because a picture update touched them.
+void pds_frame_stats(const PdsFrame* f,long long* rescored,long long* refreshed){
+ *rescored=f->st.rescored;
+ *refreshed=f->st.refreshed;
+}
+
+void pds_frame_destroy(PdsFrame* f){
+ if(!f)
+ return;
+ incremental_free(&f->st);
+ free(f);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdbool.h>
+#include "types.h"
+
+// libpds: in-process picture/object matcher. A context is created once from an object library and keeps
+// everything that only depends on the objects (a private copy of the objects and masks, the 8 orientations
+// for the symmetric search, the pixel samples, the object trie), so every search call only pays for the picture itself.
+//
+//   PdsOptions o; pds_default_options(&o); o.mode = SEARCH_BEST;
+//   PdsContext* ctx = pds_create(objs, M, &o);
+//   MatchResult r; pds_search_buffer(ctx, id, N, pixels, threshold, &r);
+//   pds_destroy(ctx);
+//
+// A context may be used by one thread at a time; each call runs its own OpenMP parallel regions.
+//
+// Frames support pictures that change in small regions: pds_frame_create caches a picture together with
+// per-window results, pds_frame_update applies a dirty rectangle and only rescans the windows that overlap
+// it, and pds_frame_search / pds_frame_search_all answer from the cache (see incremental_* in compute.c).
+//
+// The remaining searches take their parameters per call and run over the context's plain objects: the
+// coarse-grid searches (pds_search_strided, pds_search_all_strided), the K best candidates
+// (pds_search_topk), one first-match search per threshold (pds_search_sweep) and the first match of
+// arbitrary (picture, object) pairs (pds_search_pairs).
+
+// Options of a search context; start from pds_default_options.
+typedef struct{
+    SearchMode mode;     // any SearchMode; TOPK, SWEEP and MATRIX take no other option
+    bool symmetric;      // first-match search over the 8 rotations/mirrors of every object
+    int threads;         // OpenMP threads used by each search, 0 = runtime default
+    int sample;          // pixel-sampling prefilter size for first/all, 0 = off
+    bool sampleProb;     // probabilistic instead of exact sampling bound
+    double confidence;   // z of the probabilistic bound
+    double cluster;      // similarity pruning for first/all: medoid radius in mean |pixel difference|, 0 = off
+    bool trie;           // prefix-sharing search over the object trie for first/all
+}
+PdsOptions;
+
+typedef struct PdsContext PdsContext;
+typedef struct PdsFrame PdsFrame;
+
+void pds_default_options(PdsOptions* opt);
+PdsContext* pds_create(const ObjectT* objs,int M,const PdsOptions* opt);
+const PdsOptions* pds_options(const PdsContext* ctx);
+bool pds_search(PdsContext* ctx,const Picture* pic,double threshold,MatchResult* out);
+bool pds_search_buffer(PdsContext* ctx,int id,int N,const int* pixels,double threshold,MatchResult* out);
+int pds_search_all(PdsContext* ctx,const Picture* pic,double threshold,MatchList* out);
+int pds_search_near(PdsContext* ctx,const Picture* pic,double threshold,const MatchResult* prev,int radius,MatchResult* out);
+int pds_search_strided(PdsContext* ctx,const Picture* pic,double threshold,int stride,double factor,MatchResult* out);
+int pds_search_all_strided(PdsContext* ctx,const Picture* pic,double threshold,int stride,double factor,MatchList* out);
+int pds_search_topk(PdsContext* ctx,const Picture* pic,double threshold,int K,ScoredMatch* out);
+bool pds_search_sweep(PdsContext* ctx,const Picture* pic,const double* thresholds,int T,MatchResult* out);
+bool pds_search_pairs(PdsContext* ctx,const Picture* pics,const long long* pairs,long long count,double threshold,MatchResult* out);
+void pds_destroy(PdsContext* ctx);
+PdsFrame* pds_frame_create(PdsContext* ctx,const Picture* pic);
+bool pds_frame_update(PdsContext* ctx,PdsFrame* f,int r0,int c0,int h,int w,const int* pixels);
+bool pds_frame_search(PdsContext* ctx,PdsFrame* f,double threshold,MatchResult* out);
+int pds_frame_search_all(PdsContext* ctx,PdsFrame* f,double threshold,MatchList* out);
+void pds_frame_stats(const PdsFrame* f,long long* rescored,long long* refreshed);
+void pds_frame_destroy(PdsFrame* f);
@@ -0,0 +1,140 @@
+#include "trace.h"
+#include "io.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Execution tracer. trace_start allocates one ring buffer of 'capacity' events per OpenMP thread up front,
+// so recording a span is two clock reads and one store into the calling thread's ring: no allocation, no
+// locks and no atomics. A full ring overwrites its oldest events. Row tasks are the bulk of the events, so
+// only rows with i % rowSample == 0 are recorded; pictures, objects and phases always are. trace_collect
+// flattens the rings of a process, the driver gathers them over the ranks and trace_write_json writes the
+// Chrome trace format (chrome://tracing, ui.perfetto.dev) with one process per rank and one thread per
+// OpenMP thread.
+
+typedef struct{
+    TraceEvent* e;
+    long long n;         // events ever written; the ring holds the last min(n, capacity)
+    char pad[64-sizeof(TraceEvent*)-sizeof(long long)];
+} 
+TraceRing;
+
+int pds_trace_on=0;
+static TraceRing* g_rings=NULL;
+static int g_ringCount=0;
+static int g_capacity=0;
+static int g_rowSample=1;
+static double g_origin=0.0;
+static long long g_unringed=0;   // events of threads without a ring (nested or grown teams)
+
+// Starts tracing with rings for omp_get_max_threads() threads; the current time becomes time zero.
+// Returns false if memory runs out.
+bool trace_start(int rowSample,int capacity){
+ trace_stop();
+ g_ringCount=omp_get_max_threads();
+ g_capacity=capacity>0?capacity:1;
+ g_rowSample=rowSample>0?rowSample:1;
+ g_unringed=0;
+ g_rings=(TraceRing*)calloc((size_t)g_ringCount,sizeof(TraceRing));
+ bool ok=g_rings!=NULL;
+ for(int t=0;t<g_ringCount && ok;++t){
+    g_rings[t].e=(TraceEvent*)malloc((size_t)g_capacity*sizeof(TraceEvent));
+    ok=g_rings[t].e!=NULL;
+}
+ if(!ok){
+    trace_stop();
+    return false;
+}
+ g_origin=omp_get_wtime();
+ pds_trace_on=1;
+ return true;
+}
+
+// Opens a span: returns its start time, or -1 when the span is not recorded (tracing off or a row left
+// out by the sampling). Pass the value on to trace_end.
+double trace_begin(int kind,int arg){
+ if(!pds_trace_on || (kind==TRACE_ROW && arg%g_rowSample!=0)) 
+ return -1.0;
+ return omp_get_wtime()-g_origin;
+}
+
+void trace_end(int kind,int arg,double t0){
+ if(t0<0.0 || !pds_trace_on) 
+ return;
+ const int tid=omp_get_thread_num();
+ if(tid>=g_ringCount){
+    __atomic_fetch_add(&g_unringed,1,__ATOMIC_RELAXED);
+    return;
+}
+ TraceRing* r=&g_rings[tid];
+ TraceEvent* e=&r->e[r->n%g_capacity];
+ e->t0=t0;
+ e->t1=omp_get_wtime()-g_origin;
+ e->kind=kind;
+ e->arg=arg;
+ e->tid=tid;
+ e->rank=0;
+ r->n++;
+}
+
+// Copies the events held by all rings into one array (oldest first per thread), tagged with 'rank'. Sets
+// *dropped to the number of events lost: overwritten in full rings, or recorded by a thread that has no
+// ring. Returns the number of events, or -1 if memory runs out.
+int trace_collect(int rank,TraceEvent** out,long long* dropped){
+ long long total=0;
+ *dropped=__atomic_load_n(&g_unringed,__ATOMIC_RELAXED);
+ for(int t=0;t<g_ringCount;++t){
+    const long long n=g_rings[t].n;
+    total+=n<g_capacity?n:g_capacity;
+    if(n>g_capacity) 
+    *dropped+=n-g_capacity;
+}
+ *out=(TraceEvent*)malloc(((size_t)total+1)*sizeof(TraceEvent));
+ if(!*out) 
+ return -1;
+ int k=0;
+ for(int t=0;t<g_ringCount;++t){
+    const TraceRing* r=&g_rings[t];
+    const long long first=r->n>g_capacity?r->n-g_capacity:0;
+    for(long long x=first;x<r->n;++x){
+        (*out)[k]=r->e[x%g_capacity];
+        (*out)[k++].rank=rank;
+    }
+}
+ return k;
+}
+
+void trace_stop(void){
+ pds_trace_on=0;
+ for(int t=0;t<g_ringCount && g_rings;++t) 
+ free(g_rings[t].e);
+ free(g_rings);
+ g_rings=NULL;
+ g_ringCount=0;
+}
+
+// This function writes the events in the Chrome trace event format: every span is a complete ("X") event
+// with microsecond timestamps, pid = rank and tid = OpenMP thread, plus metadata naming the ranks.
+bool trace_write_json(const char* path,const TraceEvent* e,int n,int ranks){
+ static const char* cats[4]={"phase","picture","object","row"};
+ FILE* f=fopen(path,"w");
+ if(!f){
+    fprintf(stderr,"Failed to open trace file: %s\n",path);
+    return false;
+}
+ fprintf(f,"{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+ for(int q=0;q<ranks;++q) 
+ fprintf(f,"{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}},\n",q,q);
+ for(int x=0;x<n;++x){
+    char name[64];
+    if(e[x].kind==TRACE_PHASE) 
+    snprintf(name,sizeof name,"%s",run_phase_name(e[x].arg));
+    else snprintf(name,sizeof name,"%s %d",cats[e[x].kind],e[x].arg);
+    fprintf(f,"{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}%s\n",
+            name,cats[e[x].kind],e[x].t0*1e6,(e[x].t1-e[x].t0)*1e6,e[x].rank,e[x].tid,x+1<n?",":"");
+}
+ fprintf(f,"]}\n");
+ fclose(f);
+ return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+
+// Optional execution tracer (see trace.c). The engines and the driver mark spans with trace_begin /
+// trace_end; while tracing is off both return right away without reading the clock.
+typedef enum{
+    TRACE_PHASE=0,       // arg: RunPhase
+    TRACE_PICTURE,       // arg: picture id
+    TRACE_OBJECT,        // arg: object id
+    TRACE_ROW            // arg: candidate row i
+} 
+TraceKind;
+
+// One complete span; times are seconds since trace_start.
+typedef struct{
+    double t0;
+    double t1;
+    int kind;
+    int arg;
+    int tid;
+    int rank;
+} 
+TraceEvent;
+
+extern int pds_trace_on;
+
+bool trace_start(int rowSample,int capacity);
+double trace_begin(int kind,int arg);
+void trace_end(int kind,int arg,double t0);
+int trace_collect(int rank,TraceEvent** out,long long* dropped);
+void trace_stop(void);
+bool trace_write_json(const char* path,const TraceEvent* e,int n,int ranks);
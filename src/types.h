@@ -3,19 +3,179 @@ typedef struct{
     int id;
     int N;
     int* a;
+    int* roiRow;
+    int* roiSpan;
 } 
 Picture;
+typedef struct{
+    int count;
+    int total;
+    int probabilistic;
+    double z;
+    long long restSum;
+    int* r;
+    int* c;
+    int* v;
+} 
+SamplePlan;
+// Distinct values of an object's (active) pixels in ascending order, with their multiplicities; used by the 
+// pair prefilter (see prepare_value_summaries).
+typedef struct{
+    int count;
+    int* v;
+    int* c;
+} 
+ValueSummary;
+// Membership of an object in a cluster of same-size near-duplicates (see prepare_object_clusters). A 
+// member points at its medoid, which precedes it in the object array; a medoid records its last member.
+typedef struct{
+    int leader;          // index of the medoid, -1 for the medoid itself
+    long long dist;      // L1 pixel distance to the medoid
+    int lastMember;      // medoid only: index of its last member
+} 
+ObjectCluster;
 typedef struct{
     int id;
     int n;
     int* a;
+    SamplePlan* sample;
+    int* maskRow;
+    int* maskCol;
+    int* maskVal;
+    ValueSummary* values;
+    ObjectCluster* cluster;
 } 
 ObjectT;
+// Object trie of the prefix-sharing search (see prepare_object_trie). A node is one distinct object row at
+// its depth; every object whose rows above and at that depth are identical passes through the same node.
+typedef struct{
+    const int* row;      // the n pixels of the row, inside the first object that has it
+    int child;           // first node one row deeper, -1 at the last row
+    int sibling;         // next node with the same parent, -1 if none
+    int minObj;          // smallest object index below this node
+    int leaf;            // last row only: smallest object ending here, the others follow ObjectTrie.next
+}
+TrieNode;
+typedef struct{
+    int n;               // object size of the group
+    int masked;          // a masked object scored on its own (nodes unused), -1 for a trie group
+    int minObj;          // smallest object index of the group
+    int root;            // first node of depth 0
+    int count;
+    int cap;
+    TrieNode* nodes;
+}
+TrieGroup;
+typedef struct{
+    int groups;
+    TrieGroup* g;        // in order of their smallest object index
+    int* next;           // next object with identical pixels, -1 if none
+    long long nodes;     // trie nodes over all groups
+    long long rows;      // object rows they stand for
+}
+ObjectTrie;
 typedef struct{
     int pictureId;
     int found;
     int objectId;
     int posI;
     int posJ;
+    double score;
+    int orientation;
 } 
 MatchResult;
+typedef struct{
+    int id;
+    int n;
+    int count;
+    int orient[8];
+    int* a;
+} 
+SymObject;
+typedef struct{
+    int objectId;
+    int posI;
+    int posJ;
+} 
+MatchHit;
+typedef struct{
+    int pictureId;
+    int count;
+    int cap;
+    MatchHit* hits;
+} 
+MatchList;
+typedef struct{
+    double score;
+    int objectId;
+    int posI;
+    int posJ;
+} 
+ScoredMatch;
+typedef enum{
+    SEARCH_FIRST=0,
+    SEARCH_ALL,
+    SEARCH_BEST,
+    SEARCH_TOPK,
+    SEARCH_SWEEP,
+    SEARCH_MATRIX
+} 
+SearchMode;
+typedef struct{
+    Picture pic;
+    int M;
+    double** score;
+    unsigned char** exact;
+    long long* objSum;
+    long long* sat;
+    int minv;
+    int maxv;
+    long long rescored;
+    long long refreshed;
+} 
+IncrementalState;
+// Phases of a run, timed on every rank (see phase_enter in main.c)
+typedef enum{
+    PHASE_PARSE=0,
+    PHASE_DISTRIBUTE,
+    PHASE_COMPUTE,
+    PHASE_GATHER,
+    PHASE_WRITE,
+    PHASE_COUNT
+} 
+RunPhase;
+// Hot-path counters of the scoring engines, only collected in a build with -DPDS_COUNTERS (see HOT_ADD in
+// compute.c). All fields are long long so that a record travels as HOT_FIELDS MPI_LONG_LONG values.
+typedef struct{
+    long long windows;       // windows scored by a kernel
+    long long pixels;        // pixels compared by the kernels
+    long long abandoned;     // windows abandoned early by the bounded kernels
+    long long repeated;      // windows skipped as repeats of their left neighbour
+    long long clustered;     // member windows pruned by their medoid
+    long long sampled;       // windows rejected by the sampling prefilter
+    long long pairs;         // (picture, object) pairs skipped by the pair prefilter
+    long long cancelled;     // row tasks stopped because another task found the match
+} 
+HotCounters;
+#define HOT_FIELDS 8
+typedef struct{
+    long long pictureId;
+    HotCounters c;
+} 
+HotPicture;
+// Phase times in seconds reduced over the ranks; entry PHASE_COUNT is the sum of all phases of a rank. 
+// The counters are only set in a counters build.
+typedef struct{
+    int ranks;
+    double min[PHASE_COUNT+1];
+    double avg[PHASE_COUNT+1];
+    double max[PHASE_COUNT+1];
+    const double* perRank;         // 'ranks' rows of PHASE_COUNT+1 entries
+    const HotCounters* total;      // NULL without counters
+    const HotCounters* objects;    // per object, objectCount entries
+    const int* objectIds;
+    int objectCount;
+    const HotPicture* pictures;    // per searched picture
+    int pictureCount;
+} 
+RunReport;